@@ -0,0 +1,1326 @@
+#include "stdlib.h"
+#include "string.h"
+#include "limits.h"
+#include "stdint.h"
+
+#include "image_raster.h"
+#include "raster_parallel.h"
+#include "raster_arena.h"
+#include "raster_color.h"
+#include "raster_dither.h"
+#include "raster_edges.h"
+#include "raster_glyphs.h"
+#include "raster_map.h"
+#include "raster_shape.h"
+#include "raster_stats.h"
+#include "raster_stb.h"
+
+#include "stb_image.h"
+
+// owns all memory of its conversions, see raster_arena
+struct raster_context {
+    raster_arena arena;
+    char* frame; // handed out by the last conversion, may have overflowed to the heap
+};
+
+
+static inline int clamp(int val, int min, int max) {
+	if(val < min) {
+        return min;
+	}
+    if(val > max) {
+        return max;
+    }
+    return val;
+}
+static inline int clamp_min(int val, int min) {
+	if(val < min) {
+        return min;
+	}
+    return val;
+}
+static inline int clamp_max(int val, int max) {
+    if(val > max) {
+        return max;
+    }
+    return val;
+}
+
+// start of a timed stage, the clock is only read if somebody keeps stats
+static unsigned long long stage_start(const raster_stats* stats) {
+    return stats != NULL ? stats_now_ns() : 0;
+}
+
+static void count_decode(raster_stats* stats, unsigned long long start, size_t bytes_read) {
+    if(stats != NULL) {
+        stats->decode_ns += stats_now_ns() - start;
+        stats->bytes_read += bytes_read;
+    }
+}
+
+// shared read-only state of one conversion, split across threads by output rows
+typedef struct {
+    image* img;
+    const raster_kernels* kernels;
+    const raster_glyphs* glyphs;
+    int sample_size;
+    int x_len;
+    int y_len;
+    double* integral; // summed-area table, NULL unless the integral mode is used
+    char* out;        // y_len lines of x_len characters and '\n'
+    int fixed_point;  // luma plane, integer sums and integral_fixed instead of brightness and integral
+    unsigned int* integral_fixed;
+    unsigned char* colors; // rgb of every cell, x_len*y_len*3, summed by the bands alongside brightness; NULL without color
+    int convert;           // the bands convert their rows to the brightness (luma) plane right before summing them
+    int shape;             // glyphs by line_from_shape_sums, direct float path only
+    raster_dither dither;  // float path only, the bands fill means and the wavefront turns them into glyphs
+    int edges;             // edge_glyphs over the direct float path
+    float* means;          // cell averages, x_len*y_len
+    float* errors;         // what dithering pushed into each cell, x_len*(y_len+2) with room for the error past the last row
+    raster_arena* arena; // where buffers come from, NULL for the heap
+} raster_job;
+
+// per-thread buffers for the direct path
+typedef struct {
+    float* cols;
+    float* sums;
+    unsigned short* cols_fixed;
+    unsigned int* sums_fixed;
+    const float** edge_rows; // the band's brightness rows for edges, sample_size + 2 with the rows above and below
+    float* edge_cols; // gradient_band's column sums of them, 5 rows of width
+    float* edge_sums; // their block sums, 5 rows of x_len
+    shape_band shape; // with job->shape
+    color_band color; // with job->colors
+} raster_scratch;
+
+static void convert_rows(void* arg, int begin, int end) {
+    raster_job* job = arg;
+    image* img = job->img;
+    if(img->stride == (size_t)img->width * img->channels) { // tightly packed, convert the whole range at once
+        size_t count = (size_t)(end - begin) * img->width;
+        if(job->fixed_point) {
+            job->kernels->luma(image_row(img, begin), (unsigned char*)luma_row(img, begin), count, img->channels);
+        }else {
+            job->kernels->brightness(image_row(img, begin), (float*)brightness_row(img, begin), count, img->channels);
+        }
+        return;
+    }
+    for(int j=begin;j<end;j++) {
+        if(job->fixed_point) {
+            job->kernels->luma(image_row(img, j), (unsigned char*)luma_row(img, j), img->width, img->channels);
+        }else {
+            job->kernels->brightness(image_row(img, j), (float*)brightness_row(img, j), img->width, img->channels);
+        }
+    }
+}
+
+static void alloc_plane(raster_job* job) {
+    image* img = job->img;
+    if(job->fixed_point) {
+        img->luma = arena_alloc(job->arena, (size_t)img->width * img->height);
+    }else {
+        img->brightness = arena_alloc(job->arena, sizeof(float) * img->width * img->height);
+    }
+}
+
+// one pass over the decoded buffer, interleaved channels -> planar brightness (or luma for fixed point)
+static void convert_to_brightness(raster_job* job, int threads) {
+    alloc_plane(job);
+    run_parallel(convert_rows, job, job->img->height, threads);
+}
+
+// row prefix sums, rows are independent
+static void integral_rows(void* arg, int begin, int end) {
+    raster_job* job = arg;
+    image* img = job->img;
+    size_t stride = (size_t)img->width + 1;
+    for(int j=begin;j<end;j++) {
+        const float* src = brightness_row(img, j);
+        double* row = job->integral + stride*(j+1);
+        double row_sum = 0;
+        row[0] = 0;
+        for(int i=0;i<img->width;i++) {
+            row_sum += src[i];
+            row[i+1] = row_sum;
+        }
+    }
+}
+
+// adds each row to the one above it, columns are independent
+static void integral_columns(void* arg, int begin, int end) {
+    raster_job* job = arg;
+    image* img = job->img;
+    size_t stride = (size_t)img->width + 1;
+    for(int j=1;j<img->height;j++) {
+        const double* prev = job->integral + stride*j;
+        double* row = job->integral + stride*(j+1);
+        for(int i=begin+1;i<=end;i++) {
+            row[i] += prev[i];
+        }
+    }
+}
+
+// same two passes over luma, wrapping unsigned sums: a block's sum comes out exact as long as the block
+// itself stays below 2^32, whatever the image size
+static void integral_rows_fixed(void* arg, int begin, int end) {
+    raster_job* job = arg;
+    image* img = job->img;
+    size_t stride = (size_t)img->width + 1;
+    for(int j=begin;j<end;j++) {
+        const unsigned char* src = luma_row(img, j);
+        unsigned int* row = job->integral_fixed + stride*(j+1);
+        unsigned int row_sum = 0;
+        row[0] = 0;
+        for(int i=0;i<img->width;i++) {
+            row_sum += src[i];
+            row[i+1] = row_sum;
+        }
+    }
+}
+
+static void integral_columns_fixed(void* arg, int begin, int end) {
+    raster_job* job = arg;
+    image* img = job->img;
+    size_t stride = (size_t)img->width + 1;
+    for(int j=1;j<img->height;j++) {
+        const unsigned int* prev = job->integral_fixed + stride*j;
+        unsigned int* row = job->integral_fixed + stride*(j+1);
+        for(int i=begin+1;i<=end;i++) {
+            row[i] += prev[i];
+        }
+    }
+}
+
+// summed-area table of brightness: (width+1)*(height+1) entries, first row and column are zero
+static void build_integral(raster_job* job, int threads) {
+    image* img = job->img;
+    size_t stride = (size_t)img->width + 1;
+    if(job->fixed_point) {
+        job->integral_fixed = arena_alloc(job->arena, sizeof(unsigned int) * stride * ((size_t)img->height + 1));
+        memset(job->integral_fixed, 0, sizeof(unsigned int) * stride);
+        run_parallel(integral_rows_fixed, job, img->height, threads);
+        run_parallel(integral_columns_fixed, job, img->width, threads);
+        return;
+    }
+    job->integral = arena_alloc(job->arena, sizeof(double) * stride * ((size_t)img->height + 1));
+    memset(job->integral, 0, sizeof(double) * stride);
+    run_parallel(integral_rows, job, img->height, threads);
+    run_parallel(integral_columns, job, img->width, threads);
+}
+
+// block average in O(1), independent of sample_size
+static float integral_mean(image* img, double* integral, int x, int y, int sample_size) {
+    size_t stride = (size_t)img->width + 1;
+    int x1 = clamp_max(x + sample_size, img->width);
+    int y1 = clamp_max(y + sample_size, img->height);
+    double sum = integral[y1*stride + x1] - integral[y*stride + x1] - integral[y1*stride + x] + integral[y*stride + x];
+    return (float)(sum / ((x1 - x) * (y1 - y)));
+}
+
+static char get_char_integral(image* img, const raster_glyphs* glyphs, double* integral, int x, int y, int sample_size) {
+    return glyph_for(glyphs, integral_mean(img, integral, x, y, sample_size));
+}
+
+static raster_mode resolve_mode(raster_mode mode, int sample_size) {
+    if(mode == RASTER_MODE_AUTO) {
+        return sample_size > 1 ? RASTER_MODE_INTEGRAL : RASTER_MODE_DIRECT;
+    }
+    return mode;
+}
+
+// shape matching needs a sub-cell grid of whole pixels
+static int use_shape(raster_options options) {
+    return options.shape && options.sample_size >= RASTER_SHAPE_GRID;
+}
+
+static raster_dither use_dither(raster_options options) {
+    return use_shape(options) ? RASTER_DITHER_NONE : options.dither;
+}
+
+static int use_edges(raster_options options) {
+    return options.edges && !use_shape(options) && use_dither(options) == RASTER_DITHER_NONE;
+}
+
+// the integer sums only hold so many luma values: 16-bit column sums take 257 rows,
+// 32-bit block sums 255*4104*4104; larger samples take the float path
+static int use_fixed_point(raster_options options) {
+    if(!options.fixed_point || use_shape(options) || use_dither(options) != RASTER_DITHER_NONE || use_edges(options)) {
+        return 0;
+    }
+    if(resolve_mode(options.mode, options.sample_size) == RASTER_MODE_INTEGRAL) {
+        return options.sample_size <= 4104;
+    }
+    return options.sample_size <= 257;
+}
+
+static void alloc_scratch(raster_job* job, raster_scratch* scratch) {
+    memset(scratch, 0, sizeof(*scratch));
+    if(job->colors != NULL) {
+        color_band_alloc(&scratch->color, job->arena, job->kernels, job->img->width, job->img->channels, job->sample_size);
+    }
+    if(job->shape) {
+        shape_band_alloc(&scratch->shape, job->arena, job->kernels, job->img->width, job->sample_size);
+        return;
+    }
+    if(job->fixed_point) {
+        scratch->cols_fixed = arena_alloc(job->arena, sizeof(unsigned short) * ((size_t)job->img->width + 1)); // block_sum_u16 reads one past
+        scratch->sums_fixed = arena_alloc(job->arena, sizeof(unsigned int) * job->x_len);
+        scratch->cols_fixed[job->img->width] = 0;
+        return;
+    }
+    if(job->edges) {
+        scratch->edge_rows = arena_alloc(job->arena, sizeof(const float*) * ((size_t)job->sample_size + 2));
+        scratch->edge_cols = arena_alloc(job->arena, sizeof(float) * 5 * job->img->width);
+        scratch->edge_sums = arena_alloc(job->arena, sizeof(float) * 5 * job->x_len);
+        return;
+    }
+    scratch->cols = arena_alloc(job->arena, sizeof(float) * job->img->width);
+    scratch->sums = arena_alloc(job->arena, sizeof(float) * job->x_len);
+}
+
+static void free_scratch(raster_job* job, raster_scratch* scratch) {
+    arena_free(job->arena, scratch->edge_sums);
+    arena_free(job->arena, scratch->edge_cols);
+    arena_free(job->arena, (void*)scratch->edge_rows);
+    arena_free(job->arena, scratch->sums_fixed);
+    arena_free(job->arena, scratch->cols_fixed);
+    arena_free(job->arena, scratch->sums);
+    arena_free(job->arena, scratch->cols);
+    if(scratch->shape.cols != NULL) {
+        shape_band_free(&scratch->shape, job->arena);
+    }
+    if(scratch->color.cols != NULL) {
+        color_band_free(&scratch->color, job->arena);
+    }
+}
+
+// block sums of one band of count_y rows -> x_len characters
+static void line_from_sums(const raster_glyphs* glyphs, const float* sums, int width, int x_len, int sample_size, int count_y, char* line) {
+    for(int i=0;i<x_len;i++) {
+        int count_x = clamp_max(sample_size, width - i*sample_size);
+        line[i] = glyph_for(glyphs, sums[i] / (count_x * count_y));
+    }
+}
+
+static void means_from_sums(const float* sums, int width, int x_len, int sample_size, int count_y, float* means) {
+    for(int i=0;i<x_len;i++) {
+        int count_x = clamp_max(sample_size, width - i*sample_size);
+        means[i] = sums[i] / (count_x * count_y);
+    }
+}
+
+// the same for integer sums, every cell but the last one has the same size
+static void line_from_sums_fixed(const raster_glyphs* glyphs, const unsigned int* sums, int x_len,
+                                 unsigned long long reciprocal, unsigned long long last_reciprocal, char* line) {
+    int last = x_len - 1;
+    for(int i=0;i<last;i++) {
+        line[i] = glyph_for_sum(glyphs, sums[i], reciprocal);
+    }
+    line[last] = glyph_for_sum(glyphs, sums[last], last_reciprocal);
+}
+
+// ramp and edge glyphs of a band from the rows in scratch->edge_rows: the block sums of the brightness and of
+// the gradients all come out of one gradient_band pass
+static void edge_line(raster_job* job, raster_scratch* scratch, int count_y, char* line) {
+    image* img = job->img;
+    job->kernels->gradient_band(scratch->edge_rows, count_y, scratch->edge_cols, img->width);
+    for(int k=0;k<5;k++) {
+        job->kernels->block_sum(scratch->edge_cols + (size_t)k * img->width, scratch->edge_sums + (size_t)k * job->x_len,
+                                img->width, job->sample_size);
+    }
+    line_from_sums(job->glyphs, scratch->edge_sums, img->width, job->x_len, job->sample_size, count_y, line);
+    edge_glyphs(scratch->edge_sums + job->x_len, img->width, job->x_len, job->sample_size, count_y, line);
+}
+
+// Every row of a band goes through here right before its brightness is summed: it is converted to the plane
+// if the bands do that and its colors are added to the band's, so the pixels are read while still in cache
+static void band_row(raster_job* job, raster_scratch* scratch, int y) {
+    if(job->convert) {
+        convert_rows(job, y, y + 1);
+    }
+    if(job->colors != NULL) {
+        color_band_add(&scratch->color, image_row(job->img, y));
+    }
+}
+
+static void band_colors(raster_job* job, raster_scratch* scratch, int j) {
+    if(job->colors != NULL) {
+        color_band_average(&scratch->color, job->colors + (size_t)j * job->x_len * 3);
+    }
+}
+
+// x_len characters of output row j, depends only on j so rows can go in any order
+static void rasterize_row(raster_job* job, raster_scratch* scratch, int j, char* line) {
+    image* img = job->img;
+    int sample_size = job->sample_size;
+    if(job->integral) {
+        for(int i=0;i<job->x_len;i++) {
+            line[i] = get_char_integral(img, job->glyphs, job->integral, i*sample_size, j*sample_size, sample_size);
+        }
+    }else if(job->shape) {
+        // every row goes into the column sums of its sub-row, sub-cells are summed from those
+        int y = j*sample_size;
+        int count_y = clamp_max(sample_size, img->height - y);
+        memset(scratch->shape.cols, 0, sizeof(float) * RASTER_SHAPE_GRID * img->width);
+        for(int r=0;r<count_y;r++) {
+            band_row(job, scratch, y + r);
+            job->kernels->column_sum(brightness_row(img, y + r), scratch->shape.cols + (size_t)shape_sub_row(r, count_y) * img->width, img->width);
+        }
+        line_from_shape_sums(&scratch->shape, job->glyphs, count_y, line);
+    }else if(job->edges) {
+        // the rows around the band repeat the image's first and last row
+        int y = j*sample_size;
+        int count_y = clamp_max(sample_size, img->height - y);
+        for(int r=0;r<count_y;r++) {
+            band_row(job, scratch, y + r);
+        }
+        for(int r=-1;r<=count_y;r++) {
+            scratch->edge_rows[r + 1] = brightness_row(img, clamp(y + r, 0, img->height - 1));
+        }
+        edge_line(job, scratch, count_y, line);
+    }else if(sample_size == 1) {
+        band_row(job, scratch, j);
+        const float* row = brightness_row(img, j);
+        for(int i=0;i<img->width;i++) {
+            line[i] = glyph_for(job->glyphs, row[i]);
+        }
+    }else {
+        // sum sample_size rows into column sums, then columns into cells: the band is swept row-major, every
+        // row read once and in order, instead of each cell going back over rows the cell before it pulled in
+        int y = j*sample_size;
+        int count_y = clamp_max(sample_size, img->height - y);
+        memset(scratch->cols, 0, sizeof(float) * img->width);
+        for(int r=0;r<count_y;r++) {
+            band_row(job, scratch, y + r);
+            job->kernels->column_sum(brightness_row(img, y + r), scratch->cols, img->width);
+        }
+        job->kernels->block_sum(scratch->cols, scratch->sums, img->width, sample_size);
+        line_from_sums(job->glyphs, scratch->sums, img->width, job->x_len, sample_size, count_y, line);
+    }
+}
+
+// the block averages rasterize_row would look up glyphs for, x_len of them for output row j
+static void row_means(raster_job* job, raster_scratch* scratch, int j, float* means) {
+    image* img = job->img;
+    int sample_size = job->sample_size;
+    if(job->integral) {
+        for(int i=0;i<job->x_len;i++) {
+            means[i] = integral_mean(img, job->integral, i*sample_size, j*sample_size, sample_size);
+        }
+    }else if(sample_size == 1) {
+        band_row(job, scratch, j);
+        memcpy(means, brightness_row(img, j), sizeof(float) * img->width);
+    }else {
+        int y = j*sample_size;
+        int count_y = clamp_max(sample_size, img->height - y);
+        memset(scratch->cols, 0, sizeof(float) * img->width);
+        for(int r=0;r<count_y;r++) {
+            band_row(job, scratch, y + r);
+            job->kernels->column_sum(brightness_row(img, y + r), scratch->cols, img->width);
+        }
+        job->kernels->block_sum(scratch->cols, scratch->sums, img->width, sample_size);
+        means_from_sums(scratch->sums, img->width, job->x_len, sample_size, count_y, means);
+    }
+}
+
+// rasterize_row on luma: every cell is an integer sum that the glyph table turns into a character
+// through one reciprocal per cell size, only the last column and row can have a different one
+static void rasterize_row_fixed(raster_job* job, raster_scratch* scratch, int j, char* line) {
+    image* img = job->img;
+    const raster_glyphs* glyphs = job->glyphs;
+    int sample_size = job->sample_size;
+    int y = j*sample_size;
+    int count_y = clamp_max(sample_size, img->height - y);
+    int last = job->x_len - 1;
+    int last_x = img->width - last*sample_size;
+    unsigned long long reciprocal = glyph_reciprocal(glyphs, 255u * sample_size * count_y);
+    unsigned long long last_reciprocal = glyph_reciprocal(glyphs, 255u * last_x * count_y);
+    if(job->integral_fixed) {
+        size_t stride = (size_t)img->width + 1;
+        const unsigned int* top = job->integral_fixed + stride*y;
+        const unsigned int* bottom = job->integral_fixed + stride*(y + count_y);
+        for(int i=0;i<last;i++) {
+            int x = i*sample_size;
+            unsigned int sum = bottom[x + sample_size] - top[x + sample_size] - bottom[x] + top[x];
+            line[i] = glyph_for_sum(glyphs, sum, reciprocal);
+        }
+        int x = last*sample_size;
+        line[last] = glyph_for_sum(glyphs, bottom[img->width] - top[img->width] - bottom[x] + top[x], last_reciprocal);
+    }else if(sample_size == 1) {
+        band_row(job, scratch, j);
+        const unsigned char* row = luma_row(img, j);
+        for(int i=0;i<img->width;i++) {
+            line[i] = glyph_for_sum(glyphs, row[i], reciprocal);
+        }
+    }else {
+        memset(scratch->cols_fixed, 0, sizeof(unsigned short) * img->width);
+        for(int r=0;r<count_y;r++) {
+            band_row(job, scratch, y + r);
+            job->kernels->column_sum_u8(luma_row(img, y + r), scratch->cols_fixed, img->width);
+        }
+        job->kernels->block_sum_u16(scratch->cols_fixed, scratch->sums_fixed, img->width, sample_size, 1);
+        line_from_sums_fixed(glyphs, scratch->sums_fixed, job->x_len, reciprocal, last_reciprocal, line);
+    }
+}
+
+static void rasterize_band(void* arg, int begin, int end) {
+    raster_job* job = arg;
+    raster_scratch scratch;
+    alloc_scratch(job, &scratch);
+    size_t line_len = (size_t)job->x_len + 1;
+    for(int j=begin;j<end;j++) {
+        char* line = job->out + line_len*j;
+        if(job->means != NULL) {
+            row_means(job, &scratch, j, job->means + (size_t)job->x_len*j);
+        }else if(job->fixed_point) {
+            rasterize_row_fixed(job, &scratch, j, line);
+        }else {
+            rasterize_row(job, &scratch, j, line);
+        }
+        band_colors(job, &scratch, j);
+        line[job->x_len] = '\n';
+    }
+    free_scratch(job, &scratch);
+}
+
+// cells published at a time: a chunk waits for the row above to publish the chunk after it, so rows trail each
+// other by 9 to 16 cells and a frame x_len cells wide has at least x_len / 16 rows in flight (12 at 200 cells);
+// publishing is an atomic store
+#define DITHER_CHUNK 8
+
+// one output row of a dithered frame: a chunk of cells may go once the row above has finished the cell right
+// after it, by then that row has pushed all its error into them and writes only further right
+static void dither_row(void* arg, raster_wavefront* wave, int j) {
+    raster_job* job = arg;
+    const float* means = job->means + (size_t)job->x_len*j;
+    float* errors = job->errors + (size_t)job->x_len*j;
+    char* line = job->out + ((size_t)job->x_len + 1)*j;
+    dither_carry carry = {0, 0};
+    for(int begin=0;begin<job->x_len;begin+=DITHER_CHUNK) {
+        int end = clamp_max(begin + DITHER_CHUNK, job->x_len);
+        wavefront_wait(wave, j - 1, clamp_max(end + 1, job->x_len));
+        dither_cells(job->glyphs, job->dither, means, errors, errors + job->x_len, errors + 2*job->x_len,
+                     job->x_len, begin, end, &carry, line);
+        wavefront_publish(wave, j, end);
+    }
+    line[job->x_len] = '\n';
+}
+
+size_t raster_frame_size(int width, int height, int sample_size) {
+    size_t x_len = (size_t)(width-1)/sample_size + 1;
+    size_t y_len = (size_t)(height-1)/sample_size + 1;
+    return (x_len + 1) * y_len;
+}
+
+size_t raster_frame_bound(int width, int height, raster_options options) {
+    if(options.color == RASTER_COLOR_NONE || options.sample_size < 1 || width < 1 || height < 1) {
+        return raster_frame_size(width, height, options.sample_size < 1 ? 1 : options.sample_size);
+    }
+    size_t x_len = (size_t)(width-1)/options.sample_size + 1;
+    size_t y_len = (size_t)(height-1)/options.sample_size + 1;
+    return color_line_bound((int)x_len, options.color) * y_len;
+}
+
+// every band writes its own slice of the frame so any thread count gives the same bytes; with colors out is
+// the character grid and colors gets the cell colors, summed from img->data in the same band pass as the
+// brightness, which is why color frames always take the direct path
+static void rasterize_frame_in(image* img, raster_options options, char* out, unsigned char* colors, raster_arena* arena) {
+    if(colors != NULL) {
+        options.mode = RASTER_MODE_DIRECT;
+    }
+    raster_job job = {img, get_raster_kernels(options.simd), get_default_glyphs()};
+    job.arena = arena;
+    raster_glyphs* custom = NULL;
+    if(options.ramp != NULL) {
+        custom = arena_alloc(arena, sizeof(raster_glyphs));
+        if(build_glyphs(custom, options.ramp, strlen(options.ramp)) == 0) {
+            job.glyphs = custom;
+        }
+    }
+    int threads = resolve_threads(options.threads);
+    job.fixed_point = use_fixed_point(options);
+    job.shape = use_shape(options);
+    job.dither = use_dither(options);
+    job.edges = use_edges(options);
+    raster_stats* stats = options.stats;
+    job.sample_size = options.sample_size;
+    job.x_len = (img->width-1)/job.sample_size + 1;
+    job.y_len = (img->height-1)/job.sample_size + 1;
+    job.integral = NULL;
+    job.integral_fixed = NULL;
+    job.out = out;
+    job.colors = colors;
+    unsigned long long start = stage_start(stats);
+    if((job.fixed_point ? (void*)img->luma : (void*)img->brightness) == NULL) {
+        // a color frame reads every pixel in the band pass anyway, so its rows are converted there too;
+        // edges look at the rows around a band and need the whole plane first
+        if(colors != NULL && !job.edges) {
+            alloc_plane(&job);
+            job.convert = 1;
+        }else {
+            convert_to_brightness(&job, threads);
+        }
+    }
+    unsigned long long converted = stage_start(stats);
+    if(!job.shape && !job.edges && resolve_mode(options.mode, job.sample_size) == RASTER_MODE_INTEGRAL) {
+        build_integral(&job, threads);
+    }
+    if(job.dither != RASTER_DITHER_NONE) {
+        job.means = arena_alloc(arena, sizeof(float) * job.x_len * job.y_len);
+        job.errors = arena_alloc(arena, sizeof(float) * job.x_len * ((size_t)job.y_len + 2));
+        memset(job.errors, 0, sizeof(float) * job.x_len * ((size_t)job.y_len + 2));
+        run_parallel(rasterize_band, &job, job.y_len, threads);
+        run_wavefront(dither_row, &job, job.y_len, threads, arena);
+        arena_free(arena, job.errors);
+        arena_free(arena, job.means);
+    }else {
+        run_parallel(rasterize_band, &job, job.y_len, threads);
+    }
+    if(stats != NULL) {
+        stats->convert_ns += converted - start;
+        stats->raster_ns += stats_now_ns() - converted;
+        stats->pixels += (unsigned long long)img->width * img->height;
+        if(colors == NULL) {
+            stats->chars += ((size_t)job.x_len + 1) * job.y_len; // color frames count theirs once written
+        }
+    }
+    arena_free(arena, job.integral_fixed);
+    arena_free(arena, job.integral);
+    arena_free(arena, custom);
+}
+
+// A color frame is rasterized to characters and cell colors from arena first and then written with its escapes
+// in one pass: to *out, as far as it fits in out_capacity, or to a frame allocated from arena if *out is NULL,
+// sized for the bound and shrunk to what was written. Returns the frame's size either way.
+static size_t rasterize_color(image* img, raster_options options, char** out, size_t out_capacity, raster_arena* arena) {
+    int x_len = (img->width-1)/options.sample_size + 1;
+    int y_len = (img->height-1)/options.sample_size + 1;
+    char* grid = arena_alloc(arena, raster_frame_size(img->width, img->height, options.sample_size));
+    unsigned char* colors = arena_alloc(arena, (size_t)x_len * y_len * 3);
+    rasterize_frame_in(img, options, grid, colors, arena);
+    unsigned long long start = stage_start(options.stats);
+    size_t bound = raster_frame_bound(img->width, img->height, options);
+    int allocated = *out == NULL;
+    if(allocated) {
+        *out = arena_alloc(arena, bound);
+        out_capacity = bound;
+    }
+    char* spill = out_capacity < bound ? arena_alloc(arena, color_line_bound(x_len, options.color)) : NULL;
+    size_t size = color_frame(grid, colors, x_len, y_len, options.color, options.color_tolerance, *out, out_capacity, spill);
+    arena_free(arena, spill);
+    if(allocated) {
+        *out = arena_realloc(arena, *out, bound, size);
+    }
+    if(options.stats != NULL) {
+        options.stats->raster_ns += stats_now_ns() - start;
+        options.stats->chars += size;
+    }
+    arena_free(arena, colors);
+    arena_free(arena, grid);
+    return size;
+}
+
+size_t rasterize_frame(image* img, raster_options options, char* out) {
+    if(options.color != RASTER_COLOR_NONE) {
+        return rasterize_color(img, options, &out, raster_frame_bound(img->width, img->height, options), NULL);
+    }
+    rasterize_frame_in(img, options, out, NULL, NULL);
+    return raster_frame_size(img->width, img->height, options.sample_size);
+}
+
+// validates the image and clamps sample_size to it
+static int check_image(int width, int height, int channels, raster_options* options) {
+    if(options->sample_size < 1 || width < 1 || height < 1 || channels < 1 || channels > 4) {
+        return RASTER_ERROR_ARGUMENT;
+    }
+    if(options->ramp != NULL && (options->ramp[0] == '\0' || strlen(options->ramp) > RASTER_GLYPH_LEVELS)) {
+        return RASTER_ERROR_ARGUMENT;
+    }
+    options->sample_size = clamp_max(options->sample_size, width > height ? width : height);
+    return RASTER_OK;
+}
+
+// check_image for caller pixels, whose rows must not overlap
+static int check_pixels(int width, int height, int channels, size_t stride, raster_options* options) {
+    int status = check_image(width, height, channels, options);
+    if(status == RASTER_OK && stride < (size_t)width * channels) {
+        return RASTER_ERROR_ARGUMENT;
+    }
+    return status;
+}
+
+// JPEGs decode straight to 1/2, 1/4 or 1/8 size when every cell covers whole reduced pixels: each
+// reduced pixel is the average of the block it replaces, so the cells keep (almost) the same averages
+// and the frame keeps its size while the decode, its memory and everything after shrink with it;
+// shape matching still needs its sub-cells
+static int decode_scale_shift(raster_options options) {
+    if(options.full_decode) {
+        return 0;
+    }
+    int min_sample = options.shape ? RASTER_SHAPE_GRID : 1;
+    int shift = 0;
+    while(shift < 3 && options.sample_size % (2 << shift) == 0 && options.sample_size / (2 << shift) >= min_sample) {
+        shift++;
+    }
+    return shift;
+}
+
+// returns the channels to ask stb_image for, 0 for the image's own; channels comes from the header,
+// 0 if that wasn't read: gray_decode keeps alpha unless the image is known not to have any
+static int begin_decode(raster_options options, int channels) {
+    stbi_set_jpeg_scale_on_load_thread(decode_scale_shift(options));
+    if(!options.gray_decode) {
+        return 0;
+    }
+    return channels == 1 || channels == 3 ? 1 : 2;
+}
+
+// sample_size and channels in decoded pixels
+static void end_decode(raster_options* options, int desired_channels, int* channels) {
+    options->sample_size >>= stbi_jpeg_scale_applied();
+    stbi_set_jpeg_scale_on_load_thread(0);
+    if(desired_channels != 0) {
+        *channels = desired_channels;
+    }
+}
+
+// rasterizes stb_image output, the decoded pixels are released as soon as the brightness plane exists;
+// color frames need them until the cell colors are summed and go through rasterize_color with out and out_capacity
+static size_t rasterize_decoded(image* img, raster_options options, char** out, size_t out_capacity, raster_arena* arena) {
+    if(options.color != RASTER_COLOR_NONE) {
+        size_t size = rasterize_color(img, options, out, out_capacity, arena);
+        stbi_image_free(img->data);
+        img->data = NULL;
+        arena_free(arena, img->luma);
+        arena_free(arena, img->brightness);
+        return size;
+    }
+    raster_job job = {img, get_raster_kernels(options.simd)};
+    job.arena = arena;
+    job.fixed_point = use_fixed_point(options);
+    unsigned long long start = stage_start(options.stats);
+    convert_to_brightness(&job, resolve_threads(options.threads));
+    if(options.stats != NULL) {
+        options.stats->convert_ns += stats_now_ns() - start;
+    }
+    stbi_image_free(img->data);
+    img->data = NULL;
+    rasterize_frame_in(img, options, *out, NULL, arena);
+    arena_free(arena, img->luma);
+    arena_free(arena, img->brightness);
+    return raster_frame_size(img->width, img->height, options.sample_size);
+}
+
+int raster_file_info(const char* image_name, int* width, int* height, int* channels) {
+    return stbi_info(image_name, width, height, channels) ? RASTER_OK : RASTER_ERROR_DECODE;
+}
+
+int raster_memory_info(const unsigned char* encoded, size_t encoded_size, int* width, int* height, int* channels) {
+    if(encoded_size > INT_MAX || !stbi_info_from_memory(encoded, (int)encoded_size, width, height, channels)) {
+        return RASTER_ERROR_DECODE;
+    }
+    return RASTER_OK;
+}
+
+int raster_from_pixels(const unsigned char* pixels, int width, int height, int channels, size_t stride,
+                       raster_options options, char* out, size_t out_capacity, size_t* out_size) {
+    int status = check_pixels(width, height, channels, stride, &options);
+    if(status != RASTER_OK) {
+        return status;
+    }
+    image img = {(unsigned char*)pixels, width, height, channels, stride, NULL};
+    if(options.color != RASTER_COLOR_NONE) {
+        *out_size = rasterize_color(&img, options, &out, out_capacity, NULL);
+        free(img.luma);
+        free(img.brightness);
+        return *out_size <= out_capacity ? RASTER_OK : RASTER_ERROR_BUFFER_TOO_SMALL;
+    }
+    *out_size = raster_frame_size(width, height, options.sample_size);
+    if(out_capacity < *out_size) {
+        return RASTER_ERROR_BUFFER_TOO_SMALL;
+    }
+    rasterize_frame(&img, options, out);
+    free(img.luma);
+    free(img.brightness);
+    return RASTER_OK;
+}
+
+int raster_from_memory(const unsigned char* encoded, size_t encoded_size,
+                       raster_options options, char* out, size_t out_capacity, size_t* out_size) {
+    int width, height, channels;
+    int status = raster_memory_info(encoded, encoded_size, &width, &height, &channels);
+    if(status == RASTER_OK) {
+        status = check_image(width, height, channels, &options);
+    }
+    if(status != RASTER_OK) {
+        return status;
+    }
+    *out_size = raster_frame_size(width, height, options.sample_size);
+    if(out_capacity < *out_size) { // checked from the header, before paying for the decode; a color frame is never smaller
+        if(options.color != RASTER_COLOR_NONE) {
+            *out_size = raster_frame_bound(width, height, options);
+        }
+        return RASTER_ERROR_BUFFER_TOO_SMALL;
+    }
+    unsigned long long start = stage_start(options.stats);
+    int desired = begin_decode(options, channels);
+    unsigned char* pixels = stbi_load_from_memory(encoded, (int)encoded_size, &width, &height, &channels, desired);
+    end_decode(&options, desired, &channels);
+    count_decode(options.stats, start, encoded_size);
+    if(pixels == NULL) {
+        return RASTER_ERROR_DECODE;
+    }
+    image img = {pixels, width, height, channels, (size_t)width * channels, NULL};
+    *out_size = rasterize_decoded(&img, options, &out, out_capacity, NULL);
+    return *out_size <= out_capacity ? RASTER_OK : RASTER_ERROR_BUFFER_TOO_SMALL;
+}
+
+int raster_decode(const unsigned char* encoded, size_t encoded_size, raster_options* options, image* img) {
+    int width, height, channels;
+    int status = raster_memory_info(encoded, encoded_size, &width, &height, &channels);
+    if(status == RASTER_OK) {
+        status = check_image(width, height, channels, options);
+    }
+    if(status != RASTER_OK) {
+        return status;
+    }
+    unsigned long long start = stage_start(options->stats);
+    int desired = begin_decode(*options, channels);
+    unsigned char* pixels = stbi_load_from_memory(encoded, (int)encoded_size, &width, &height, &channels, desired);
+    end_decode(options, desired, &channels);
+    count_decode(options->stats, start, encoded_size);
+    if(pixels == NULL) {
+        return RASTER_ERROR_DECODE;
+    }
+    image decoded = {pixels, width, height, channels, (size_t)width * channels, NULL};
+    *img = decoded;
+    return RASTER_OK;
+}
+
+void raster_image_brightness(image* img, raster_options options) {
+    raster_job job = {img, get_raster_kernels(options.simd)};
+    job.fixed_point = use_fixed_point(options);
+    unsigned long long start = stage_start(options.stats);
+    convert_to_brightness(&job, resolve_threads(options.threads));
+    if(options.stats != NULL) {
+        options.stats->convert_ns += stats_now_ns() - start;
+    }
+}
+
+void raster_free_image(image* img) {
+    stbi_image_free(img->data);
+    free(img->luma);
+    free(img->brightness);
+    img->data = NULL;
+    img->luma = NULL;
+    img->brightness = NULL;
+}
+
+// decoded pixels from any of the loaders into a malloc'ed frame, takes ownership of pixels;
+// options.sample_size is still the one the decode was set up with
+static int rasterize_loaded(unsigned char* pixels, int width, int height, int channels, int desired_channels,
+                            raster_options options, char** out, size_t* out_size) {
+    end_decode(&options, desired_channels, &channels);
+    if(pixels == NULL) {
+        return RASTER_ERROR_DECODE;
+    }
+    int status = check_image(width, height, channels, &options);
+    if(status != RASTER_OK) {
+        stbi_image_free(pixels);
+        return status;
+    }
+    *out = options.color == RASTER_COLOR_NONE ? malloc(raster_frame_size(width, height, options.sample_size)) : NULL;
+    image img = {pixels, width, height, channels, (size_t)width * channels, NULL};
+    *out_size = rasterize_decoded(&img, options, out, SIZE_MAX, NULL);
+    return RASTER_OK;
+}
+
+// the channels of a file for begin_decode, the header is only read if they matter
+static int file_channels(const char* image_name, raster_options options) {
+    int width, height, channels = 0;
+    if(options.gray_decode) {
+        raster_file_info(image_name, &width, &height, &channels);
+    }
+    return channels;
+}
+
+static int mapped_channels(const raster_map* map, raster_options options) {
+    int width, height, channels = 0;
+    if(options.gray_decode) {
+        raster_memory_info(map->data, map->size, &width, &height, &channels);
+    }
+    return channels;
+}
+
+// files are decoded straight from a mapping where possible; returns 0 for files that can't be mapped
+// or are too big for stb_image's int lengths, those go through its stdio loaders instead
+static int map_input(const char* image_name, raster_map* map) {
+    if(map_file(image_name, map) != 0) {
+        return 0;
+    }
+    if(map->size > INT_MAX) {
+        unmap_file(map);
+        return 0;
+    }
+    return 1;
+}
+
+// bytes stb_image has taken from a file it read through stdio, 0 for pipes and the like
+static size_t file_bytes_read(FILE* file) {
+    long position = ftell(file);
+    return position > 0 ? (size_t)position : 0;
+}
+
+int raster_from_file(const char* image_name, raster_options options, char** out, size_t* out_size) {
+    int width, height, channels, desired;
+    unsigned char* pixels = NULL;
+    unsigned long long start = stage_start(options.stats);
+    raster_map map;
+    if(map_input(image_name, &map)) {
+        desired = begin_decode(options, mapped_channels(&map, options));
+        pixels = stbi_load_from_memory(map.data, (int)map.size, &width, &height, &channels, desired);
+        count_decode(options.stats, start, map.size);
+        unmap_file(&map);
+    }else {
+        desired = begin_decode(options, file_channels(image_name, options));
+        FILE* file = fopen(image_name, "rb");
+        if(file != NULL) {
+            pixels = stbi_load_from_file(file, &width, &height, &channels, desired);
+            count_decode(options.stats, start, file_bytes_read(file));
+            fclose(file);
+        }
+    }
+    return rasterize_loaded(pixels, width, height, channels, desired, options, out, out_size);
+}
+
+// raster_io_callbacks in front of stb_image, counting the bytes that go through
+typedef struct {
+    const raster_io_callbacks* io;
+    void* user;
+    unsigned long long bytes;
+} counted_io;
+
+static int counted_read(void* user, char* data, int size) {
+    counted_io* counted = user;
+    int read = counted->io->read(counted->user, data, size);
+    if(read > 0) {
+        counted->bytes += read;
+    }
+    return read;
+}
+
+static void counted_skip(void* user, int n) {
+    counted_io* counted = user;
+    counted->io->skip(counted->user, n);
+    counted->bytes += n;
+}
+
+static int counted_eof(void* user) {
+    counted_io* counted = user;
+    return counted->io->eof(counted->user);
+}
+
+static const stbi_io_callbacks counted_callbacks = {counted_read, counted_skip, counted_eof};
+
+// a stream can't be read twice, so alpha is kept for gray_decode
+int raster_from_callbacks(const raster_io_callbacks* io, void* user, raster_options options, char** out, size_t* out_size) {
+    counted_io counted = {io, user, 0};
+    int width, height, channels;
+    unsigned long long start = stage_start(options.stats);
+    int desired = begin_decode(options, 0);
+    unsigned char* pixels = stbi_load_from_callbacks(&counted_callbacks, &counted, &width, &height, &channels, desired);
+    count_decode(options.stats, start, counted.bytes);
+    return rasterize_loaded(pixels, width, height, channels, desired, options, out, out_size);
+}
+
+static int stream_read(void* user, char* data, int size) {
+    return (int)fread(data, 1, size, (FILE*)user);
+}
+
+// pipes can't seek, so skipping means reading into nowhere
+static void stream_skip(void* user, int n) {
+    char discard[4096];
+    while(n > 0) {
+        size_t read = fread(discard, 1, n < (int)sizeof(discard) ? (size_t)n : sizeof(discard), (FILE*)user);
+        if(read == 0) {
+            break;
+        }
+        n -= (int)read;
+    }
+}
+
+static int stream_eof(void* user) {
+    return feof((FILE*)user) || ferror((FILE*)user);
+}
+
+int raster_from_stream(FILE* stream, raster_options options, char** out, size_t* out_size) {
+    raster_io_callbacks io = {stream_read, stream_skip, stream_eof};
+    return raster_from_callbacks(&io, stream, options, out, out_size);
+}
+
+// behind the raster_lines_* functions: every decoded row is converted and added to the column sums of
+// its band right away, and each complete band becomes one line for the callback
+typedef struct {
+    raster_options options; // sample_size in decoded pixels once begun
+    raster_line_callback callback;
+    void* user;
+    image img; // brightness or luma hold the single row being added, the ring of edge_ring rows with edges
+    raster_job job;
+    raster_scratch scratch;
+    raster_glyphs* custom;
+    char* line;
+    unsigned char* line_colors;     // the band's cell colors from scratch.color, NULL without color
+    char* color_line;               // line with its escapes, what the callback gets
+    int color_current;              // color the terminal is left in by the lines so far
+    float* dither_rows;             // 3 rows of x_len errors for dithering: this line's and the next two lines'
+    int dither_current;             // which of them is this line
+    int edge_pending;               // rows of a band whose line waits for the row below its last one, 0 if none
+    int edge_ring;                  // with edges brightness keeps this many rows, sample_size + 2, row y at y % edge_ring
+    int band_rows; // rows in the column sums so far
+    int status;    // RASTER_ERROR_DECODE until the decoder reaches row_stream_begin
+    raster_stats stats; // this conversion alone, whatever the decoder doesn't spend in the callbacks is decode time
+    unsigned long long start;
+} row_stream;
+
+// channels is already the decoded count
+static int row_stream_begin(void* user, int width, int height, int channels) {
+    row_stream* stream = user;
+    end_decode(&stream->options, 0, &channels);
+    stream->status = check_image(width, height, channels, &stream->options);
+    if(stream->status != RASTER_OK) {
+        return 0;
+    }
+    raster_job* job = &stream->job;
+    image* img = &stream->img;
+    img->width = width;
+    img->height = height;
+    img->channels = channels;
+    job->img = img;
+    job->kernels = get_raster_kernels(stream->options.simd);
+    job->glyphs = get_default_glyphs();
+    if(stream->options.ramp != NULL) {
+        stream->custom = malloc(sizeof(raster_glyphs));
+        if(build_glyphs(stream->custom, stream->options.ramp, strlen(stream->options.ramp)) == 0) {
+            job->glyphs = stream->custom;
+        }
+    }
+    job->fixed_point = use_fixed_point(stream->options);
+    job->shape = use_shape(stream->options);
+    job->dither = use_dither(stream->options);
+    job->edges = use_edges(stream->options);
+    job->sample_size = stream->options.sample_size;
+    job->x_len = (width-1)/job->sample_size + 1;
+    job->y_len = (height-1)/job->sample_size + 1;
+    stream->edge_ring = job->edges ? job->sample_size + 2 : 1; // a band with the rows above and below it
+    if(job->fixed_point) {
+        img->luma = malloc(width);
+    }else {
+        img->brightness = malloc(sizeof(float) * width * stream->edge_ring);
+    }
+    alloc_scratch(job, &stream->scratch);
+    stream->line = malloc((size_t)job->x_len + 1);
+    stream->line[job->x_len] = '\n';
+    if(stream->options.color != RASTER_COLOR_NONE) {
+        color_band_alloc(&stream->scratch.color, NULL, job->kernels, width, channels, job->sample_size);
+        stream->line_colors = malloc((size_t)job->x_len * 3);
+        stream->color_line = malloc(color_line_bound(job->x_len, stream->options.color));
+        stream->color_current = -1;
+    }
+    if(job->dither != RASTER_DITHER_NONE) {
+        stream->dither_rows = calloc((size_t)job->x_len * 3, sizeof(float));
+    }
+    stream->stats.pixels = (unsigned long long)width * height;
+    return 1;
+}
+
+// the band's line with its colors to the callback, edge bands get all their glyphs here from the rows
+// row_stream_edges picked; raster time counted from since, returns 0 if the callback wants to stop
+static int row_stream_send(row_stream* stream, int count_y, int last, unsigned long long since) {
+    raster_job* job = &stream->job;
+    int timed = stream->options.stats != NULL;
+    if(job->edges) {
+        edge_line(job, &stream->scratch, count_y, stream->line);
+    }
+    const char* line = stream->line;
+    size_t line_size = (size_t)job->x_len + 1;
+    if(stream->line_colors != NULL) {
+        line_size = color_line(stream->line, stream->line_colors, job->x_len, stream->options.color, stream->options.color_tolerance,
+                               &stream->color_current, last, stream->color_line);
+        line = stream->color_line;
+    }
+    stream->stats.chars += line_size;
+    unsigned long long reduced = timed ? stats_now_ns() : 0;
+    stream->stats.raster_ns += reduced - since;
+    int keep_going = stream->callback(stream->user, line, line_size);
+    if(timed) {
+        stream->stats.output_ns += stats_now_ns() - reduced;
+    }
+    if(!keep_going) {
+        stream->status = RASTER_ERROR_ABORTED;
+    }
+    return keep_going;
+}
+
+// points the scratch's edge rows at the band of count_y rows from band_y and the rows around it in the ring
+static void row_stream_edges(row_stream* stream, int band_y, int count_y) {
+    image* img = &stream->img;
+    for(int r=-1;r<=count_y;r++) {
+        int y = clamp(band_y + r, 0, img->height - 1);
+        stream->scratch.edge_rows[r + 1] = img->brightness + (size_t)(y % stream->edge_ring) * img->width;
+    }
+}
+
+// same column and block sums as the direct path, so the lines match it byte for byte; with edges a band's
+// line goes out when the row below it has arrived
+static int row_stream_row(void* user, const unsigned char* pixels, int y) {
+    row_stream* stream = user;
+    raster_job* job = &stream->job;
+    raster_scratch* scratch = &stream->scratch;
+    image* img = &stream->img;
+    int sample_size = job->sample_size;
+    int timed = stream->options.stats != NULL;
+    unsigned long long start = timed ? stats_now_ns() : 0;
+    unsigned long long converted;
+    if(job->fixed_point) {
+        if(stream->band_rows == 0) {
+            memset(scratch->cols_fixed, 0, sizeof(unsigned short) * img->width);
+        }
+        job->kernels->luma(pixels, img->luma, img->width, img->channels);
+        converted = timed ? stats_now_ns() : 0;
+        job->kernels->column_sum_u8(img->luma, scratch->cols_fixed, img->width);
+    }else if(job->shape) {
+        if(stream->band_rows == 0) {
+            memset(scratch->shape.cols, 0, sizeof(float) * RASTER_SHAPE_GRID * img->width);
+        }
+        job->kernels->brightness(pixels, img->brightness, img->width, img->channels);
+        converted = timed ? stats_now_ns() : 0;
+        int band_y = y - stream->band_rows;
+        int sub_row = shape_sub_row(stream->band_rows, clamp_max(sample_size, img->height - band_y));
+        job->kernels->column_sum(img->brightness, scratch->shape.cols + (size_t)sub_row * img->width, img->width);
+    }else {
+        float* brightness = img->brightness + (size_t)(y % stream->edge_ring) * img->width;
+        job->kernels->brightness(pixels, brightness, img->width, img->channels);
+        converted = timed ? stats_now_ns() : 0;
+        if(job->edges) {
+            // the rows stay in the ring until the band's sums come out of gradient_band
+            if(stream->edge_pending > 0) {
+                int count_y = stream->edge_pending;
+                stream->edge_pending = 0;
+                row_stream_edges(stream, y - count_y, count_y);
+                if(!row_stream_send(stream, count_y, 0, converted)) {
+                    return 0;
+                }
+                converted = timed ? stats_now_ns() : 0;
+            }
+        }else {
+            if(stream->band_rows == 0) {
+                memset(scratch->cols, 0, sizeof(float) * img->width);
+            }
+            job->kernels->column_sum(brightness, scratch->cols, img->width);
+        }
+    }
+    if(stream->line_colors != NULL) {
+        color_band_add(&scratch->color, pixels);
+    }
+    stream->stats.convert_ns += converted - start;
+    int count_y = ++stream->band_rows;
+    int last = y == img->height - 1;
+    if(count_y < sample_size && !last) {
+        if(timed) {
+            stream->stats.raster_ns += stats_now_ns() - converted;
+        }
+        return 1;
+    }
+    if(job->fixed_point) {
+        int last_x = img->width - (job->x_len - 1)*sample_size;
+        job->kernels->block_sum_u16(scratch->cols_fixed, scratch->sums_fixed, img->width, sample_size, 1);
+        line_from_sums_fixed(job->glyphs, scratch->sums_fixed, job->x_len,
+                             glyph_reciprocal(job->glyphs, 255u * sample_size * count_y),
+                             glyph_reciprocal(job->glyphs, 255u * last_x * count_y), stream->line);
+    }else if(job->shape) {
+        line_from_shape_sums(&scratch->shape, job->glyphs, count_y, stream->line);
+    }else if(stream->dither_rows != NULL) {
+        // lines come in order, so the rows below simply rotate through the three
+        int x_len = job->x_len;
+        float* errors = stream->dither_rows + (size_t)x_len * stream->dither_current;
+        float* below = stream->dither_rows + (size_t)x_len * ((stream->dither_current + 1) % 3);
+        float* below2 = stream->dither_rows + (size_t)x_len * ((stream->dither_current + 2) % 3);
+        job->kernels->block_sum(scratch->cols, scratch->sums, img->width, sample_size);
+        means_from_sums(scratch->sums, img->width, x_len, sample_size, count_y, scratch->sums); // in place
+        dither_carry carry = {0, 0};
+        dither_cells(job->glyphs, job->dither, scratch->sums, errors, below, below2, x_len, 0, x_len, &carry, stream->line);
+        memset(errors, 0, sizeof(float) * x_len);
+        stream->dither_current = (stream->dither_current + 1) % 3;
+    }else if(!job->edges) { // edge lines are summed in row_stream_send
+        job->kernels->block_sum(scratch->cols, scratch->sums, img->width, sample_size);
+        line_from_sums(job->glyphs, scratch->sums, img->width, job->x_len, sample_size, count_y, stream->line);
+    }
+    stream->band_rows = 0;
+    if(stream->line_colors != NULL) {
+        color_band_average(&scratch->color, stream->line_colors);
+    }
+    if(job->edges) {
+        if(!last) {
+            stream->edge_pending = count_y;
+            if(timed) {
+                stream->stats.raster_ns += stats_now_ns() - converted;
+            }
+            return 1;
+        }
+        row_stream_edges(stream, y + 1 - count_y, count_y);
+    }
+    return row_stream_send(stream, count_y, last, converted);
+}
+
+// returns the channels to decode to, see begin_decode
+static int row_stream_init(row_stream* stream, raster_options options, int channels, raster_line_callback callback, void* user) {
+    memset(stream, 0, sizeof(*stream));
+    options.mode = RASTER_MODE_DIRECT; // the only mode that needs nothing but the current band
+    stream->options = options;
+    stream->callback = callback;
+    stream->user = user;
+    stream->status = RASTER_ERROR_DECODE;
+    stream->start = stage_start(options.stats);
+    return begin_decode(options, channels);
+}
+
+// bytes_read is what the decoder took from the input
+static int row_stream_finish(row_stream* stream, int decoded, size_t bytes_read) {
+    stbi_set_jpeg_scale_on_load_thread(0); // in case the decode failed before row_stream_begin
+    raster_stats* stats = stream->options.stats;
+    if(stats != NULL) {
+        raster_stats* own = &stream->stats;
+        stats->bytes_read += bytes_read;
+        stats->pixels += own->pixels;
+        stats->chars += own->chars;
+        stats->decode_ns += stats_now_ns() - stream->start - own->convert_ns - own->raster_ns - own->output_ns;
+        stats->convert_ns += own->convert_ns;
+        stats->raster_ns += own->raster_ns;
+        stats->output_ns += own->output_ns;
+    }
+    free_scratch(&stream->job, &stream->scratch);
+    free(stream->line);
+    free(stream->line_colors);
+    free(stream->color_line);
+    free(stream->dither_rows);
+    free(stream->custom);
+    free(stream->img.luma);
+    free(stream->img.brightness);
+    if(decoded) {
+        return RASTER_OK;
+    }
+    return stream->status == RASTER_OK ? RASTER_ERROR_DECODE : stream->status;
+}
+
+int raster_lines_from_file(const char* image_name, raster_options options, raster_line_callback callback, void* user) {
+    row_stream stream;
+    stbi_row_callbacks rows = {row_stream_begin, row_stream_row};
+    int desired, decoded = 0;
+    size_t bytes_read = 0;
+    raster_map map;
+    if(map_input(image_name, &map)) {
+        desired = row_stream_init(&stream, options, mapped_channels(&map, options), callback, user);
+        decoded = stbi_load_rows_from_memory(map.data, (int)map.size, desired, &rows, &stream);
+        bytes_read = map.size;
+        unmap_file(&map);
+    }else {
+        desired = row_stream_init(&stream, options, file_channels(image_name, options), callback, user);
+        FILE* file = fopen(image_name, "rb");
+        if(file != NULL) {
+            decoded = stbi_load_rows_from_file(file, desired, &rows, &stream);
+            bytes_read = file_bytes_read(file);
+            fclose(file);
+        }
+    }
+    return row_stream_finish(&stream, decoded, bytes_read);
+}
+
+int raster_lines_from_callbacks(const raster_io_callbacks* io, void* user, raster_options options,
+                                raster_line_callback callback, void* callback_user) {
+    counted_io counted = {io, user, 0};
+    row_stream stream;
+    stbi_row_callbacks rows = {row_stream_begin, row_stream_row};
+    int desired = row_stream_init(&stream, options, 0, callback, callback_user);
+    int decoded = stbi_load_rows_from_callbacks(&counted_callbacks, &counted, desired, &rows, &stream);
+    return row_stream_finish(&stream, decoded, counted.bytes);
+}
+
+int raster_lines_from_stream(FILE* stream, raster_options options, raster_line_callback callback, void* user) {
+    raster_io_callbacks io = {stream_read, stream_skip, stream_eof};
+    return raster_lines_from_callbacks(&io, stream, options, callback, user);
+}
+
+raster_context* raster_context_create(void) {
+    raster_context* ctx = malloc(sizeof(raster_context));
+    arena_init(&ctx->arena);
+    ctx->frame = NULL;
+    return ctx;
+}
+
+// drops the previous frame and everything else the last conversion left behind
+static void reset_context(raster_context* ctx) {
+    arena_free(&ctx->arena, ctx->frame);
+    ctx->frame = NULL;
+    arena_reset(&ctx->arena);
+}
+
+void raster_context_destroy(raster_context* ctx) {
+    if(ctx == NULL) {
+        return;
+    }
+    reset_context(ctx);
+    arena_destroy(&ctx->arena);
+    free(ctx);
+}
+
+int raster_context_from_pixels(raster_context* ctx, const unsigned char* pixels, int width, int height, int channels, size_t stride,
+                               raster_options options, const char** out, size_t* out_size) {
+    int status = check_pixels(width, height, channels, stride, &options);
+    if(status != RASTER_OK) {
+        return status;
+    }
+    reset_context(ctx);
+    image img = {(unsigned char*)pixels, width, height, channels, stride, NULL};
+    if(options.color != RASTER_COLOR_NONE) {
+        *out_size = rasterize_color(&img, options, &ctx->frame, SIZE_MAX, &ctx->arena);
+    }else {
+        *out_size = raster_frame_size(width, height, options.sample_size);
+        ctx->frame = arena_alloc(&ctx->arena, *out_size);
+        rasterize_frame_in(&img, options, ctx->frame, NULL, &ctx->arena);
+    }
+    arena_free(&ctx->arena, img.luma);
+    arena_free(&ctx->arena, img.brightness);
+    *out = ctx->frame;
+    return RASTER_OK;
+}
+
+int raster_context_from_memory(raster_context* ctx, const unsigned char* encoded, size_t encoded_size,
+                               raster_options options, const char** out, size_t* out_size) {
+    reset_context(ctx);
+    raster_stb_use_arena(&ctx->arena); // stb_image allocations of this call come from the context too
+    int width, height, channels;
+    int status = raster_memory_info(encoded, encoded_size, &width, &height, &channels);
+    if(status == RASTER_OK) {
+        status = check_image(width, height, channels, &options);
+    }
+    if(status == RASTER_OK) {
+        // color frames are allocated once they are measured
+        if(options.color == RASTER_COLOR_NONE) {
+            ctx->frame = arena_alloc(&ctx->arena, raster_frame_size(width, height, options.sample_size));
+        }
+        unsigned long long start = stage_start(options.stats);
+        int desired = begin_decode(options, channels);
+        unsigned char* pixels = stbi_load_from_memory(encoded, (int)encoded_size, &width, &height, &channels, desired);
+        end_decode(&options, desired, &channels);
+        count_decode(options.stats, start, encoded_size);
+        if(pixels == NULL) {
+            status = RASTER_ERROR_DECODE;
+        }else {
+            image img = {pixels, width, height, channels, (size_t)width * channels, NULL};
+            *out_size = rasterize_decoded(&img, options, &ctx->frame, SIZE_MAX, &ctx->arena);
+            *out = ctx->frame;
+        }
+    }
+    raster_stb_use_arena(NULL);
+    return status;
+}
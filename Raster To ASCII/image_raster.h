@@ -1,209 +1,196 @@
 #pragma once
 
-#include "stdlib.h"
+#include "stddef.h"
 #include "stdio.h"
-#include "string.h"
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
+#include "raster_simd.h"
 
+// pixels are addressed by explicit x/y, nothing in here changes while rasterizing
 typedef struct {
     unsigned char* data;
     int width;
     int height;
     int channels;
-    size_t current;
+    size_t stride;     // bytes between the starts of two rows of data
+    float* brightness; // width*height plane filled by convert_to_brightness, rows are width floats apart
+    unsigned char* luma; // the same for the fixed-point path, round(brightness*255)
 } image;
 
+typedef enum {
+    RASTER_MODE_AUTO,     // integral for sample_size > 1, direct otherwise
+    RASTER_MODE_DIRECT,   // average every block pixel by pixel
+    RASTER_MODE_INTEGRAL, // answer block averages from a summed-area table
+} raster_mode;
+
+typedef enum {
+    RASTER_COLOR_NONE, // characters only
+    RASTER_COLOR_256,  // ANSI escapes from the xterm 256-color palette (6x6x6 cube and 24 grays)
+    RASTER_COLOR_TRUE, // ANSI 24-bit color escapes with every channel's full 8 bits
+} raster_color;
+
+typedef enum {
+    RASTER_DITHER_NONE,            // every cell takes the glyph of its own brightness
+    RASTER_DITHER_FLOYD_STEINBERG, // 7/16 right, 3/16 5/16 1/16 to the row below
+    RASTER_DITHER_ATKINSON,        // 1/8 to two cells right, three below and one two rows down, 1/4 is dropped
+} raster_dither;
+
+// What a conversion did and where its time went. Conversions add to it, so zero it first; times are
+// monotonic nanoseconds.
+typedef struct {
+    unsigned long long bytes_read; // encoded bytes the decoder pulled in
+    unsigned long long pixels;     // decoded pixels, a reduced JPEG decode has fewer than the image
+    unsigned long long chars;      // bytes of ascii art produced, color escapes included
+    unsigned long long decode_ns;
+    unsigned long long convert_ns; // pixels to the brightness or luma plane, color frames do that in the raster pass
+    unsigned long long raster_ns;  // block sums and glyph lookup, summed-area tables included
+    unsigned long long output_ns;  // inside raster_line_callback; callers of the other functions time their own writes
+} raster_stats;
 
-static char ascii_by_brightness[] = " `.-':_,^=;><+!rc*/z?sLTv)J7(|Fi{C}fI31tlu[neoZ5Yxjya]2ESwqkP6h9d4VpOGbUAKXHm8RD#$Bg0MNWQ%&@";
-
-static inline int clamp(int val, int min, int max) {
-	if(val < min) {
-        return min;
-	}
-    if(val > max) {
-        return max;
-    }
-    return val;
-}
-static inline int clamp_min(int val, int min) {
-	if(val < min) {
-        return min;
-	}
-    return val;
-}
-static inline int clamp_max(int val, int max) {
-    if(val > max) {
-        return max;
-    }
-    return val;
-}
-
-static inline void get_rgba(int pixel, unsigned char* r, unsigned char* g, unsigned char* b, unsigned char* a) {
-    *r = (unsigned char)(pixel>>24);
-    *g = (unsigned char)(pixel>>16);
-    *b = (unsigned char)(pixel>>8);
-    *a = (unsigned char)pixel;
-}
-
-static inline void set_current_pixel(image* img, int x, int y) {
-    img->current = y*img->width + x;
-}
-
-static inline void get_current_pixel_xy(image* img, int* x, int* y) {
-    *y = img->current / img->width;
-    *x = img->current - (*y) * img->width;
-}
-
-static int get_pixel_advance(image* img) {
-    int pixel = 0;
-    for(int i = 0; i < img->channels; i++) {
-        pixel += ((int)*(img->data+(img->current+i)*img->channels)) << (8*i);
-    }
-    if(img->channels < 4) {
-        pixel += 255; //make opaque if no alpha channel
-    }
-    img->current++;
-    return pixel;
-}
+typedef struct {
+    int sample_size;
+    raster_mode mode;
+    raster_simd simd;
+    int threads; // < 1 uses every hardware thread
+    const char* ramp; // characters from darkest to brightest, NULL for the built-in ramp
+    // 8-bit luma and integer sums instead of float brightness, within one ramp step of the float path;
+    // sample sizes past 257 (direct) or 4104 (integral) stay on floats
+    int fixed_point;
+    // JPEGs are decoded at 1/2, 1/4 or 1/8 size whenever sample_size is a multiple of that factor,
+    // this turns it off; the frame has the same size either way
+    int full_decode;
+    // the decoder hands over gray (plus alpha if the image has it): JPEGs skip chroma upsampling and color
+    // conversion. Brightness then weighs red, green and blue like luma does (0.299, 0.587, 0.114)
+    // instead of evenly, so color images come out slightly different
+    int gray_decode;
+    // every character is preceded by the average color of its cell wherever that differs from the last one
+    // written (spaces excepted), see raster_frame_bound; the colors are the exact block averages of the decoded
+    // pixels in every mode, gray for gray_decode
+    raster_color color;
+    // 0 writes every cell's own color. Above that a cell stays in the color the terminal is already in while each
+    // channel is within this many levels of it (of the palette entry's color for 256): a photo's neighbouring cells
+    // rarely average the same, so this saves most escapes at the cost of the exact colors
+    int color_tolerance;
+    // glyphs are matched to the pattern inside each cell (4x4 sub-cells) among the ramp glyphs within a quarter of
+    // the ramp of its brightness glyph instead of by brightness alone; needs sample_size >= 4, always runs on float
+    // brightness with direct block sums, so fixed_point and mode don't apply, and keeps JPEG decodes at least 4
+    // pixels a cell
+    int shape;
+    // cells are quantized to the ramp as evenly spaced levels and what rounding loses is pushed on to the cells
+    // right and below, so gradients come out as a mix of neighbouring glyphs instead of bands. Rows still run on
+    // all threads, each one 9 to 16 cells behind the row above, so a frame x_len cells wide keeps up to about
+    // x_len / 16 of them busy; float brightness only like shape, which it doesn't combine with
+    raster_dither dither;
+    // cells crossed by a strong edge of one direction (Sobel over brightness) get | / - \ or _ instead of their
+    // ramp glyph; on the direct float path like shape, and left out when shape or dither is on
+    int edges;
+    raster_stats* stats; // filled in by the conversion, NULL skips the timers; one conversion at a time
+} raster_options;
+
+typedef enum {
+    RASTER_OK = 0,
+    RASTER_ERROR_DECODE = -1,           // not an image stb_image can read
+    RASTER_ERROR_ARGUMENT = -2,         // sample_size < 1, empty image, more than 4 channels, an empty ramp
+                                        // or a pixel stride shorter than width * channels
+    RASTER_ERROR_BUFFER_TOO_SMALL = -3, // *out_size holds the size that is needed
+    RASTER_ERROR_ABORTED = -4,          // a raster_line_callback returned 0
+} raster_status;
+
+// same shape as stbi_io_callbacks, for inputs that are neither files nor whole buffers
+typedef struct {
+    int (*read)(void* user, char* data, int size); // fill data with up to size bytes, return how many were read
+    void (*skip)(void* user, int n);               // skip the next n bytes
+    int (*eof)(void* user);                        // nonzero once there is nothing left to read
+} raster_io_callbacks;
 
-static void read_pixels(image* img, int* buf, int count) {
-    for(int i=0; i < count; i++) {
-        buf[i] = get_pixel_advance(img);
-    }
-}
-static void read_pixels2d(image* img, int** buf, int count_x, int count_y) {
-    size_t current = img->current;
-    int x, y;
-    get_current_pixel_xy(img, &x, &y);
-    for(int j=0; j < count_y; j++) {
-        img->current = current + img->width * j; //add row
-        read_pixels(img, buf[j], count_x);
-    }
-    if(x + count_x < img->width) { // if not reached end, put to intial row + amount read
-        img->current = current + count_x;
-    }
-}
 
-static float get_brightness(int pixel, int channels) {
-    unsigned char r, g, b, a;
-    get_rgba(pixel, &r, &g, &b, &a);
-    const float inv_255 = 1.f/255.f;
-    float brightness = 1.f-(r*inv_255 + g*inv_255 + b*inv_255)/clamp(channels, 1, 3) * (a*inv_255);
-    return brightness;
+static inline const unsigned char* image_row(const image* img, int y) {
+    return img->data + (size_t)y * img->stride;
 }
 
-static char get_ascii(float brightness) {
-    int ascii_count = sizeof(ascii_by_brightness)/sizeof(ascii_by_brightness[0]) - 1;
-    return ascii_by_brightness[clamp_max((int)(brightness * (float)ascii_count), ascii_count-1)];
+static inline const unsigned char* image_pixel(const image* img, int x, int y) {
+    return image_row(img, y) + (size_t)x * img->channels;
 }
 
-// sample_size == 1
-static char get_char(image* img) {
-    float brightness = get_brightness(get_pixel_advance(img), img->channels);
-    return get_ascii(brightness);
+static inline const float* brightness_row(const image* img, int y) {
+    return img->brightness + (size_t)y * img->width;
 }
 
-// sample_size > 1
-static char get_char_w(image* img, int** buf, int sample_size) {
-    int x, y;
-    get_current_pixel_xy(img, &x, &y);
-    int dist_to_right = img->width - (x + sample_size);
-    int dist_to_bottom = img->height - (y + sample_size);
-    int count_x = sample_size + min(dist_to_right, 0);
-    int count_y = sample_size + min(dist_to_bottom, 0);
-
-    read_pixels2d(img, buf, count_x, count_y);
-
-    float brightness = 0;
-
-    for(int j=0;j<count_y;j++) {
-        for(int i=0; i<count_x; i++) {
-            brightness += get_brightness(buf[j][i], img->channels);
-        }
-    }
-
-    brightness /= count_x * count_y;
-    return get_ascii(brightness);
+static inline float brightness_at(const image* img, int x, int y) {
+    return brightness_row(img, y)[x];
 }
 
-
-static void write_raster_to_file(image* img, FILE* file, int sample_size) {
-    char* line_buf;
-	if(sample_size == 1) { 
-        line_buf = malloc((img->width + 1) * sizeof(char));
-        line_buf[img->width] = '\0';
-        for(int j=0;j<img->height;j++) {
-            for(int i=0;i<img->width;i++) {
-                line_buf[i] = get_char(img);
-            }
-            fprintf(file, "%s\n", line_buf);
-        }
-	}else {
-        int** buf = malloc(sizeof(int*) * sample_size); //buf that will collect sample_size*sample_size pixel data
-        for(int i=0;i<sample_size;i++) {
-            buf[i] = malloc(sizeof(int) * sample_size);
-        }
-        int x_len = (img->width-1)/sample_size + 1;
-        int y_len = (img->height-1)/sample_size + 1;
-        int line_buf_len = x_len;
-        line_buf = malloc((line_buf_len + 1) * sizeof(char));
-        line_buf[line_buf_len] = '\0';
-        for(int j=0;j<y_len;j++) {
-            for(int i=0;i<x_len;i++) {
-                line_buf[i] = get_char_w(img, buf, sample_size);
-            }
-            fprintf(file, "%s\n", line_buf);
-        }
-        for(int i=0;i<sample_size;i++) {
-            free(buf[i]);
-        }
-        free(buf);
-	}
-    free(line_buf);
-    
+static inline const unsigned char* luma_row(const image* img, int y) {
+    return img->luma + (size_t)y * img->width;
 }
 
-int raster_to_ascii(char* image_name, char* file_out_name, int sample_size) {
-    assert(sample_size >= 1, "Sample size can't be lower than 1");
-
-    int width, height, channels;
-    unsigned char *stb_img = stbi_load(image_name, &width, &height, &channels, 0);
-    if (stb_img == NULL) {
-        printf("Failed to load image\n");
-        return -1;
-    }
-    assert(channels <= 4, "Cant convert image with more than 4 channels");
-
-    if(strcmp(file_out_name, "") == 0 || strcmp(file_out_name, image_name) == 0) {
-        size_t img_name_len = strlen(image_name);
-        const char name_postfix[] = ".out.txt";
-        size_t name_postfix_len = strlen(name_postfix);
-        file_out_name = malloc(sizeof(char) * (img_name_len + name_postfix_len + 1));
-        strcpy_s(file_out_name, img_name_len + 1, image_name);
-        strcpy_s(file_out_name + img_name_len, name_postfix_len + 1, name_postfix);
-    }
-
-    image img = {stb_img, width, height, channels, 0};
-
-    FILE* file_out = fopen(file_out_name, "w");
-
-    sample_size = clamp_max(sample_size, max(width,height));
-
-    printf("Input file: \"%s\", output file: \"%s\", sample size: %d\n", image_name, file_out_name, sample_size);
-    printf("Image data: width: %d, height: %d, total: %llu, channels: %d\n", width, height, (size_t)width*(size_t)height, channels);
-    printf("Converting to ASCII art...\n\n");
-
-    write_raster_to_file(&img, file_out, sample_size);
-
-    int size_x = (width-1)/sample_size + 1;
-    int size_y = (height-1)/sample_size + 1;
-    printf("Successfully converted to ASCII art\n");
-    printf("ASCII art size: width %d, height: %d, total: %llu characters\n", size_x, size_y, (size_t)size_x*(size_t)size_y);
 
-    free(file_out_name);
-    fclose(file_out);
-    stbi_image_free(stb_img);
-    return 0;
-}
\ No newline at end of file
+// None of these touch the filesystem (except raster_file_info, raster_from_file and raster_lines_from_file reading their input)
+// or print anything, failures come back as a raster_status.
+
+// bytes of ascii art for an image: one line of characters and '\n' per output row, no terminating '\0'
+size_t raster_frame_size(int width, int height, int sample_size);
+
+// Color frames vary in size with the picture and are only measured once rasterized, the functions that write
+// into a caller's buffer report RASTER_ERROR_BUFFER_TOO_SMALL after the conversion for them. This many bytes
+// always do: raster_frame_size without color, the size with an escape before every character otherwise.
+size_t raster_frame_bound(int width, int height, raster_options options);
+
+// image header only, no pixels are decoded
+int raster_file_info(const char* image_name, int* width, int* height, int* channels);
+int raster_memory_info(const unsigned char* encoded, size_t encoded_size, int* width, int* height, int* channels);
+
+// already decoded 8-bit pixels, rows are stride >= width * channels bytes apart
+int raster_from_pixels(const unsigned char* pixels, int width, int height, int channels, size_t stride,
+                       raster_options options, char* out, size_t out_capacity, size_t* out_size);
+
+// encoded image bytes (any format stb_image reads)
+int raster_from_memory(const unsigned char* encoded, size_t encoded_size,
+                       raster_options options, char* out, size_t out_capacity, size_t* out_size);
+
+// image file into a malloc'ed frame, caller frees *out
+int raster_from_file(const char* image_name, raster_options options, char** out, size_t* out_size);
+
+// encoded image pulled through callbacks into a malloc'ed frame, caller frees *out
+int raster_from_callbacks(const raster_io_callbacks* io, void* user, raster_options options, char** out, size_t* out_size);
+
+// encoded image read from an already open stream (stdin, a pipe, a socket) without seeking
+int raster_from_stream(FILE* stream, raster_options options, char** out, size_t* out_size);
+
+// one line of the frame, its characters (with their color escapes) and the '\n'; return 0 to stop the conversion
+typedef int (*raster_line_callback)(void* user, const char* line, size_t size);
+
+// The same conversions a band of sample_size rows at a time: rows are rasterized as they come out of the
+// decoder and every line goes to the callback as soon as it is complete, so memory grows with the width
+// but not the height. Baseline JPEGs and non-interlaced PNGs decode that way, other images are decoded
+// whole first. The lines are always those of RASTER_MODE_DIRECT and options.threads is not used.
+int raster_lines_from_file(const char* image_name, raster_options options, raster_line_callback callback, void* user);
+int raster_lines_from_callbacks(const raster_io_callbacks* io, void* user, raster_options options,
+                                raster_line_callback callback, void* callback_user);
+int raster_lines_from_stream(FILE* stream, raster_options options, raster_line_callback callback, void* user);
+
+// Keeps every buffer a conversion needs (decode, brightness, tables, scratch, the frame itself) and grows
+// them to the largest image seen so far, so repeated conversions through one context stop allocating
+// once warmed up. A context serves one conversion at a time; give each worker thread its own.
+typedef struct raster_context raster_context;
+
+raster_context* raster_context_create(void);
+void raster_context_destroy(raster_context* ctx);
+
+// *out points into the context and stays valid until its next conversion
+int raster_context_from_pixels(raster_context* ctx, const unsigned char* pixels, int width, int height, int channels, size_t stride,
+                               raster_options options, const char** out, size_t* out_size);
+int raster_context_from_memory(raster_context* ctx, const unsigned char* encoded, size_t encoded_size,
+                               raster_options options, const char** out, size_t* out_size);
+
+// The conversion one stage at a time, for callers that time or reuse the stages on their own:
+// raster_decode decodes like raster_from_memory does (reduced JPEG decode, gray_decode) and scales
+// options->sample_size to the decoded pixels, raster_image_brightness fills img->brightness (img->luma for
+// the fixed-point path) and rasterize_frame below turns that into the frame; raster_free_image releases
+// everything the first two allocated. Both stages must see the same options.
+int raster_decode(const unsigned char* encoded, size_t encoded_size, raster_options* options, image* img);
+void raster_image_brightness(image* img, raster_options options);
+void raster_free_image(image* img);
+
+// fills out (raster_frame_bound() bytes) and returns the frame's size, converting img->data to brightness first if
+// that has not been done; color frames also need img->data
+size_t rasterize_frame(image* img, raster_options options, char* out);
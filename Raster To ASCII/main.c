@@ -1,20 +1,474 @@
-
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "image_raster.h"
+#include "raster_parallel.h"
+#include "raster_batch.h"
+#include "raster_bench.h"
+#include "raster_sequence.h"
+#include "raster_stats.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+// "-" is stdout
+static FILE* open_output(char* file_out_name) {
+    FILE* file_out = strcmp(file_out_name, "-") == 0 ? stdout : fopen(file_out_name, "w");
+    if(file_out == NULL) {
+        fprintf(stderr, "Failed to open output file \"%s\"\n", file_out_name);
+    }
+    return file_out;
+}
+
+static void close_output(FILE* file_out) {
+    if(file_out == stdout) {
+        fflush(stdout);
+    }else {
+        fclose(file_out);
+    }
+}
 
+// the whole frame goes out in one write instead of one per line, stats may be NULL
+static int write_frame(char* file_out_name, char* frame, size_t frame_size, raster_stats* stats) {
+    unsigned long long start = stats_now_ns();
+    FILE* file_out = open_output(file_out_name);
+    if(file_out == NULL) {
+        return -1;
+    }
+    fwrite(frame, 1, frame_size, file_out);
+    close_output(file_out);
+    if(stats != NULL) {
+        stats->output_ns += stats_now_ns() - start;
+    }
+    return 0;
+}
+
+static void print_json_string(FILE* out, const char* str) {
+    fputc('"', out);
+    for(const unsigned char* c = (const unsigned char*)str; *c; c++) {
+        if(*c == '"' || *c == '\\') {
+            fputc('\\', out);
+            fputc(*c, out);
+        }else if(*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        }else {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+// --stats: one JSON object on a line of its own, on stderr since the art itself may be on stdout
+static void print_stats(const char* input, int ok, const raster_stats* stats, unsigned long long total_ns) {
+    fprintf(stderr, "{\"input\":");
+    print_json_string(stderr, input);
+    fprintf(stderr, ",\"ok\":%s,\"bytes_read\":%llu,\"pixels\":%llu,\"chars\":%llu,\"decode_ns\":%llu,\"convert_ns\":%llu,"
+                    "\"raster_ns\":%llu,\"output_ns\":%llu,\"total_ns\":%llu,\"peak_rss_bytes\":%llu}\n",
+            ok ? "true" : "false", stats->bytes_read, stats->pixels, stats->chars, stats->decode_ns, stats->convert_ns,
+            stats->raster_ns, stats->output_ns, total_ns, stats_peak_rss());
+}
+
+static int write_line(void* user, const char* line, size_t size) {
+    return fwrite(line, 1, size, (FILE*)user) == size;
+}
+
+// --stream: every line is written as soon as it is rasterized, no frame is ever held in memory
+static int stream_lines(char* image_name, char* file_out_name, raster_options options) {
+    FILE* file_out = open_output(file_out_name);
+    if(file_out == NULL) {
+        return RASTER_ERROR_ABORTED; // already reported
+    }
+    int status = image_name == NULL ? raster_lines_from_stream(stdin, options, write_line, file_out)
+                                    : raster_lines_from_file(image_name, options, write_line, file_out);
+    close_output(file_out);
+    return status;
+}
+
+// converts image_name and writes the art next to it (or to file_out_name), reporting progress on the console
+// unless the art itself goes to stdout
+static int raster_to_ascii(char* image_name, char* file_out_name, raster_options options, int lines) {
+    int quiet = strcmp(file_out_name, "-") == 0;
+    FILE* messages = quiet ? stderr : stdout;
+    int width, height, channels;
+    if(raster_file_info(image_name, &width, &height, &channels) != RASTER_OK) {
+        fprintf(messages, "Failed to load image\n");
+        return -1;
+    }
+    if(options.sample_size < 1) {
+        fprintf(messages, "Sample size can't be lower than 1\n");
+        return -1;
+    }
+    int longest = width > height ? width : height;
+    options.sample_size = options.sample_size < longest ? options.sample_size : longest;
+    int sample_size = options.sample_size;
+
+    char* out_name_buf = NULL;
+    if(strcmp(file_out_name, "") == 0 || strcmp(file_out_name, image_name) == 0) {
+        size_t img_name_len = strlen(image_name);
+        const char name_postfix[] = ".out.txt";
+        size_t name_postfix_len = strlen(name_postfix);
+        out_name_buf = malloc(sizeof(char) * (img_name_len + name_postfix_len + 1));
+        memcpy(out_name_buf, image_name, img_name_len);
+        memcpy(out_name_buf + img_name_len, name_postfix, name_postfix_len + 1);
+        file_out_name = out_name_buf;
+    }
+
+    if(!quiet) {
+        printf("Input file: \"%s\", output file: \"%s\", sample size: %d, kernels: %s, threads: %d\n", image_name, file_out_name, sample_size, get_raster_kernels(options.simd)->name, resolve_threads(options.threads));
+        printf("Image data: width: %d, height: %d, total: %llu, channels: %d\n", width, height, (unsigned long long)width*height, channels);
+        printf("Converting to ASCII art...\n\n");
+    }
+
+    if(lines) {
+        int status = stream_lines(image_name, file_out_name, options);
+        free(out_name_buf);
+        if(status != RASTER_OK) {
+            if(status != RASTER_ERROR_ABORTED) {
+                fprintf(messages, status == RASTER_ERROR_ARGUMENT ? "Cant convert image: empty ramp or more than 4 channels\n" : "Failed to load image\n");
+            }
+            return -1;
+        }
+    }else {
+        char* frame;
+        size_t frame_size;
+        int status = raster_from_file(image_name, options, &frame, &frame_size);
+        if(status != RASTER_OK) {
+            fprintf(messages, status == RASTER_ERROR_ARGUMENT ? "Cant convert image: empty ramp or more than 4 channels\n" : "Failed to load image\n");
+            free(out_name_buf);
+            return -1;
+        }
+
+        int result = write_frame(file_out_name, frame, frame_size, options.stats);
+        free(frame);
+        free(out_name_buf);
+        if(result != 0) {
+            return result;
+        }
+    }
+
+    if(!quiet) {
+        int size_x = (width-1)/sample_size + 1;
+        int size_y = (height-1)/sample_size + 1;
+        printf("Successfully converted to ASCII art\n");
+        printf("ASCII art size: width %d, height: %d, total: %llu characters\n", size_x, size_y, (unsigned long long)size_x*size_y);
+    }
+    return 0;
+}
+
+// reads one encoded image from stdin and writes the art to file_out_name, stdout unless given;
+// nothing but errors (on stderr) besides the art, so it can sit in a pipeline
+static int stream_to_ascii(char* file_out_name, raster_options options, int lines) {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    if(lines) {
+        int status = stream_lines(NULL, strcmp(file_out_name, "") == 0 ? "-" : file_out_name, options);
+        if(status != RASTER_OK && status != RASTER_ERROR_ABORTED) {
+            fprintf(stderr, status == RASTER_ERROR_ARGUMENT ? "Cant convert image: bad sample size, empty ramp or more than 4 channels\n" : "Failed to load image from stdin\n");
+        }
+        return status == RASTER_OK ? 0 : -1;
+    }
+    char* frame;
+    size_t frame_size;
+    int status = raster_from_stream(stdin, options, &frame, &frame_size);
+    if(status != RASTER_OK) {
+        fprintf(stderr, status == RASTER_ERROR_ARGUMENT ? "Cant convert image: bad sample size, empty ramp or more than 4 channels\n" : "Failed to load image from stdin\n");
+        return -1;
+    }
+    int result = write_frame(strcmp(file_out_name, "") == 0 ? "-" : file_out_name, frame, frame_size, options.stats);
+    free(frame);
+    return result;
+}
 
 int main(int argc, char** argv) {
 	char* image_name = "image.jpg";
 	char* file_out_name = "";
-	int sample_size = 1;
-	if(argc > 1) {
-		image_name = argv[1];
-		if(argc > 2) {
-			sample_size = atoi(argv[2]);
+	raster_options options = {1, RASTER_MODE_AUTO, RASTER_SIMD_AUTO, 1, NULL, 0, 0, 0, RASTER_COLOR_NONE, 0, 0, RASTER_DITHER_NONE, 0, NULL};
+	int batch = 0;
+	int lines = 0;
+	int sample_size_set = 0;
+	int threads_set = 0;
+	int bench = 0;
+	int show_stats = 0;
+	int bench_synthetic_set = 0;
+	bench_config bench_options = {1920, 1080, {3}, 1, {1, 2, 4, 8, 16}, 5, {1, 0}, 2, 10};
+	int sequence = 0;
+	sequence_config sequence_options = {0, 0, 3, -1, 0};
+	int positional = 0;
+	char** positionals = malloc(sizeof(char*) * argc);
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--mode") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			if(strcmp(argv[i], "auto") == 0) {
+				options.mode = RASTER_MODE_AUTO;
+			}else if(strcmp(argv[i], "direct") == 0) {
+				options.mode = RASTER_MODE_DIRECT;
+			}else if(strcmp(argv[i], "integral") == 0) {
+				options.mode = RASTER_MODE_INTEGRAL;
+			}else {
+				printf("Unknown mode \"%s\", expected auto, direct or integral\n", argv[i]);
+				return 1;
+			}
+		}else if(strcmp(argv[i], "--simd") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			if(strcmp(argv[i], "auto") == 0) {
+				options.simd = RASTER_SIMD_AUTO;
+			}else if(strcmp(argv[i], "scalar") == 0) {
+				options.simd = RASTER_SIMD_SCALAR;
+			}else if(strcmp(argv[i], "sse2") == 0) {
+				options.simd = RASTER_SIMD_SSE2;
+			}else if(strcmp(argv[i], "avx2") == 0) {
+				options.simd = RASTER_SIMD_AVX2;
+			}else if(strcmp(argv[i], "avx512") == 0) {
+				options.simd = RASTER_SIMD_AVX512;
+			}else {
+				printf("Unknown simd level \"%s\", expected auto, scalar, sse2, avx2 or avx512\n", argv[i]);
+				return 1;
+			}
+		}else if(strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--color") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			if(strcmp(argv[i], "none") == 0) {
+				options.color = RASTER_COLOR_NONE;
+			}else if(strcmp(argv[i], "256") == 0) {
+				options.color = RASTER_COLOR_256;
+			}else if(strcmp(argv[i], "truecolor") == 0 || strcmp(argv[i], "24bit") == 0) {
+				options.color = RASTER_COLOR_TRUE;
+			}else {
+				printf("Unknown color mode \"%s\", expected none, 256 or truecolor\n", argv[i]);
+				return 1;
+			}
+		}else if(strcmp(argv[i], "--color-tolerance") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			options.color_tolerance = atoi(argv[i]); // levels a channel may be off before the next escape, 0 exact
+		}else if(strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--dither") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			if(strcmp(argv[i], "none") == 0) {
+				options.dither = RASTER_DITHER_NONE;
+			}else if(strcmp(argv[i], "floyd-steinberg") == 0 || strcmp(argv[i], "fs") == 0) {
+				options.dither = RASTER_DITHER_FLOYD_STEINBERG;
+			}else if(strcmp(argv[i], "atkinson") == 0) {
+				options.dither = RASTER_DITHER_ATKINSON;
+			}else {
+				printf("Unknown dither \"%s\", expected none, floyd-steinberg or atkinson\n", argv[i]);
+				return 1;
+			}
+		}else if(strcmp(argv[i], "--fixed-point") == 0) {
+			options.fixed_point = 1; // integer luminance and sums
+		}else if(strcmp(argv[i], "--full-decode") == 0) {
+			options.full_decode = 1; // no reduced jpeg decode
+		}else if(strcmp(argv[i], "--shape") == 0) {
+			options.shape = 1; // glyphs by the pattern inside each cell, not brightness alone
+		}else if(strcmp(argv[i], "--edges") == 0) {
+			options.edges = 1; // direction glyphs where the image has strong edges
+		}else if(strcmp(argv[i], "--gray") == 0) {
+			options.gray_decode = 1; // luma straight from the decoder
+		}else if(strcmp(argv[i], "--stats") == 0) {
+			show_stats = 1; // timings and counters of a single conversion as a JSON line on stderr
+		}else if(strcmp(argv[i], "--stream") == 0) {
+			lines = 1; // decode and write a band of rows at a time, always the direct mode
+		}else if(strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			file_out_name = argv[i]; // "-" writes to stdout
+		}else if(strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--sample-size") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			options.sample_size = atoi(argv[i]);
+			sample_size_set = 1;
+		}else if(strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--ramp") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			options.ramp = argv[i]; // characters from darkest to brightest
+		}else if(strcmp(argv[i], "-b") == 0 || strcmp(argv[i], "--batch") == 0) {
+			batch = 1; // every positional is an input: a file, a directory, or "-" for a list of paths on stdin
+		}else if(strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--threads") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			options.threads = atoi(argv[i]); // 0 uses every hardware thread
+			threads_set = 1;
+		}else if(strcmp(argv[i], "--sequence") == 0) {
+			sequence = 1; // every positional is a frame, only what changed goes out as ANSI updates
+		}else if(strcmp(argv[i], "--raw") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			if(bench_parse_size(argv[i], &sequence_options.raw_width, &sequence_options.raw_height) != 0 ||
+			   sequence_options.raw_width < 1 || sequence_options.raw_height < 1) {
+				printf("Invalid size \"%s\", expected WIDTHxHEIGHT\n", argv[i]);
+				return 1;
+			}
+		}else if(strcmp(argv[i], "--raw-channels") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			sequence_options.raw_channels = atoi(argv[i]); // 3 for rgb24 by default
+			if(sequence_options.raw_channels < 1 || sequence_options.raw_channels > 4) {
+				printf("Raw frames have 1 to 4 channels\n");
+				return 1;
+			}
+		}else if(strcmp(argv[i], "--start") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			sequence_options.start = atoi(argv[i]); // first number of a frame%04d.png pattern
+		}else if(strcmp(argv[i], "--fps") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			sequence_options.fps = atof(argv[i]);
+		}else if(strcmp(argv[i], "--bench") == 0) {
+			bench = 1; // time every stage over synthetic images and the positional inputs
+		}else if(strcmp(argv[i], "--bench-size") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			if(bench_parse_size(argv[i], &bench_options.width, &bench_options.height) != 0) {
+				printf("Invalid size \"%s\", expected WIDTHxHEIGHT\n", argv[i]);
+				return 1;
+			}
+			bench_synthetic_set = 1;
+		}else if(strcmp(argv[i], "--bench-channels") == 0 || strcmp(argv[i], "--bench-samples") == 0 || strcmp(argv[i], "--bench-threads") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			int* values = bench_options.channels;
+			int* count = &bench_options.channel_count;
+			if(strcmp(argv[i-1], "--bench-samples") == 0) {
+				values = bench_options.sample_sizes;
+				count = &bench_options.sample_size_count;
+			}else if(strcmp(argv[i-1], "--bench-threads") == 0) {
+				values = bench_options.threads;
+				count = &bench_options.thread_count;
+			}else {
+				bench_synthetic_set = 1;
+			}
+			*count = bench_parse_list(argv[i], values, BENCH_MAX_LIST);
+			if(*count < 0) {
+				printf("Invalid list \"%s\" for %s, expected up to %d comma separated numbers\n", argv[i], argv[i-1], BENCH_MAX_LIST);
+				return 1;
+			}
+		}else if(strcmp(argv[i], "--bench-runs") == 0) {
+			if(++i >= argc) {
+				printf("Missing value for %s\n", argv[i-1]);
+				return 1;
+			}
+			bench_options.runs = atoi(argv[i]);
+			if(bench_options.runs < 1) {
+				printf("Need at least one run\n");
+				return 1;
+			}
+		}else {
+			positionals[positional++] = argv[i];
+		}
+	}
+	if(bench) {
+		// real images replace the synthetic ones unless those were asked for too, -s and -j pin one value each
+		batch_paths inputs = {0};
+		for(int i = 0; i < positional; i++) {
+			batch_add_input(&inputs, positionals[i]);
+		}
+		free(positionals);
+		if(inputs.count > 0 && !bench_synthetic_set) {
+			bench_options.width = bench_options.height = 0;
+		}
+		if(sample_size_set) {
+			bench_options.sample_sizes[0] = options.sample_size;
+			bench_options.sample_size_count = 1;
+		}
+		if(threads_set) {
+			bench_options.threads[0] = options.threads;
+			bench_options.thread_count = 1;
+		}
+		int failed = run_bench(&bench_options, &inputs, options);
+		batch_free_paths(&inputs);
+		return failed == 0 ? 0 : 1;
+	}
+	if(sequence) {
+		// the art goes to stdout unless -o says otherwise, the summary to stderr
+		if(options.color != RASTER_COLOR_NONE) {
+			printf("--sequence only updates monochrome cells, --color can't be used with it\n");
+			return 1;
 		}
+		if(positional == 0) {
+			printf("--sequence needs frames: files, a directory, a pattern like frame%%04d.png or - for stdin\n");
+			return 1;
+		}
+		FILE* file_out = open_output(strcmp(file_out_name, "") == 0 ? "-" : file_out_name);
+		if(file_out == NULL) {
+			return 1;
+		}
+		raster_stats stats = {0};
+		if(show_stats) {
+			options.stats = &stats;
+		}
+		unsigned long long start = stats_now_ns();
+		int failed = run_sequence(positionals, positional, &sequence_options, options, file_out);
+		close_output(file_out);
+		if(show_stats) {
+			print_stats(positionals[0], failed == 0, &stats, stats_now_ns() - start);
+		}
+		free(positionals);
+		return failed == 0 ? 0 : 1;
+	}
+	if(batch) {
+		// -j is the number of images converted at once here
+		batch_paths inputs = {0};
+		for(int i = 0; i < positional; i++) {
+			batch_add_input(&inputs, positionals[i]);
+		}
+		free(positionals);
+		int failed = run_batch(&inputs, options, options.threads);
+		batch_free_paths(&inputs);
+		return failed == 0 ? 0 : 1;
+	}
+	if(positional > 0) {
+		image_name = positionals[0]; // "-" reads from stdin
+	}
+	if(positional > 1 && !sample_size_set) {
+		options.sample_size = atoi(positionals[1]);
+	}
+	free(positionals);
+	raster_stats stats = {0};
+	if(show_stats) {
+		options.stats = &stats;
+	}
+	unsigned long long start = stats_now_ns();
+	int result = strcmp(image_name, "-") == 0 ? stream_to_ascii(file_out_name, options, lines)
+	                                          : raster_to_ascii(image_name, file_out_name, options, lines);
+	if(show_stats) {
+		print_stats(image_name, result == 0, &stats, stats_now_ns() - start);
 	}
-	raster_to_ascii(image_name, file_out_name, sample_size);
-	return 0;
+	return result == 0 ? 0 : 1;
 }
@@ -0,0 +1,138 @@
+#include "stdlib.h"
+#include "string.h"
+
+#include "raster_arena.h"
+
+// every arena block starts with its size and the offset of the block allocated before it, padded so the block
+// itself stays 16-byte aligned
+#define ARENA_HEADER 16
+#define ARENA_ALIGN(size) (((size) + 15) & ~(size_t)15)
+#define ARENA_TOTAL(size) (ARENA_HEADER + ARENA_ALIGN(size))
+
+static int in_arena(raster_arena* arena, void* ptr) {
+    unsigned char* p = ptr;
+    return arena->base != NULL && p >= arena->base && p < arena->base + arena->capacity;
+}
+
+static size_t block_size(void* ptr) {
+    size_t size;
+    memcpy(&size, (unsigned char*)ptr - ARENA_HEADER, sizeof(size));
+    return size;
+}
+
+static size_t block_previous(void* ptr) {
+    size_t previous;
+    memcpy(&previous, (unsigned char*)ptr - ARENA_HEADER + sizeof(size_t), sizeof(previous));
+    return previous;
+}
+
+void arena_init(raster_arena* arena) {
+    memset(arena, 0, sizeof(*arena));
+    mtx_init(&arena->lock, mtx_plain);
+}
+
+void arena_destroy(raster_arena* arena) {
+    free(arena->base);
+    mtx_destroy(&arena->lock);
+    memset(arena, 0, sizeof(*arena));
+}
+
+void arena_reset(raster_arena* arena) {
+    if(arena->peak > arena->capacity) {
+        free(arena->base);
+        arena->capacity = ARENA_ALIGN(arena->peak);
+        arena->base = malloc(arena->capacity);
+        if(arena->base == NULL) {
+            arena->capacity = 0;
+        }
+    }
+    arena->used = 0;
+    arena->last = 0;
+    arena->overflow = 0;
+}
+
+static void track_peak(raster_arena* arena) {
+    if(arena->used + arena->overflow > arena->peak) {
+        arena->peak = arena->used + arena->overflow;
+    }
+}
+
+// caller holds the lock
+static void* bump(raster_arena* arena, size_t size) {
+    size_t total = ARENA_TOTAL(size);
+    if(arena->capacity - arena->used < total) {
+        arena->overflow += total;
+        track_peak(arena);
+        return malloc(size);
+    }
+    unsigned char* header = arena->base + arena->used;
+    memcpy(header, &size, sizeof(size));
+    memcpy(header + sizeof(size_t), &arena->last, sizeof(arena->last));
+    arena->last = arena->used;
+    arena->used += total;
+    track_peak(arena);
+    return header + ARENA_HEADER;
+}
+
+void* arena_alloc(raster_arena* arena, size_t size) {
+    if(arena == NULL) {
+        return malloc(size);
+    }
+    mtx_lock(&arena->lock);
+    void* ptr = bump(arena, size);
+    mtx_unlock(&arena->lock);
+    return ptr;
+}
+
+void arena_free(raster_arena* arena, void* ptr) {
+    if(ptr == NULL) {
+        return;
+    }
+    if(arena == NULL || !in_arena(arena, ptr)) {
+        free(ptr);
+        return;
+    }
+    mtx_lock(&arena->lock);
+    if((unsigned char*)ptr - ARENA_HEADER == arena->base + arena->last && arena->used > 0) {
+        // most recent block, give the space back and let the block before it be the most recent one
+        arena->used = arena->last;
+        arena->last = block_previous(ptr);
+    }
+    mtx_unlock(&arena->lock);
+}
+
+void* arena_realloc(raster_arena* arena, void* ptr, size_t old_size, size_t size) {
+    if(ptr == NULL) {
+        return arena_alloc(arena, size);
+    }
+    if(arena == NULL) {
+        return realloc(ptr, size);
+    }
+    if(!in_arena(arena, ptr)) {
+        // bump counted the block at its old size, it now takes the new one instead
+        mtx_lock(&arena->lock);
+        size_t counted = ARENA_TOTAL(old_size);
+        arena->overflow -= counted < arena->overflow ? counted : arena->overflow;
+        arena->overflow += ARENA_TOTAL(size);
+        track_peak(arena);
+        mtx_unlock(&arena->lock);
+        return realloc(ptr, size);
+    }
+    mtx_lock(&arena->lock);
+    unsigned char* header = (unsigned char*)ptr - ARENA_HEADER;
+    old_size = block_size(ptr);
+    if(header == arena->base + arena->last && arena->capacity - arena->last >= ARENA_TOTAL(size)) {
+        // most recent block, grow or shrink it in place
+        memcpy(header, &size, sizeof(size));
+        arena->used = arena->last + ARENA_TOTAL(size);
+        track_peak(arena);
+        mtx_unlock(&arena->lock);
+        return ptr;
+    }
+    void* moved = bump(arena, size);
+    mtx_unlock(&arena->lock);
+    if(moved != NULL) {
+        memcpy(moved, ptr, old_size < size ? old_size : size);
+    }
+    return moved;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "stddef.h"
+
+#include <threads.h>
+
+#ifdef _MSC_VER
+#define RASTER_THREAD_LOCAL __declspec(thread)
+#else
+#define RASTER_THREAD_LOCAL _Thread_local
+#endif
+
+// Bump allocator for everything one conversion needs. Freeing the most recent block gives its space back, so
+// blocks freed in reverse order of allocation all do; a block freed out of that order is only reclaimed by
+// arena_reset. Requests that don't fit fall back to malloc and are counted,
+// so the next reset can grow the arena to cover them and later conversions stay off the heap.
+// Every function also accepts a NULL arena and then simply uses the heap.
+typedef struct {
+    unsigned char* base;
+    size_t capacity;
+    size_t used;
+    size_t last;     // offset of the most recent live block's header, each header keeps the one before it
+    size_t overflow; // bytes that came from malloc since the last reset
+    size_t peak;     // high-water mark of used + overflow over all conversions so far
+    mtx_t lock;      // band workers allocate their scratch concurrently
+} raster_arena;
+
+void arena_init(raster_arena* arena);
+void arena_destroy(raster_arena* arena);
+
+// releases every block and grows the arena to the peak of earlier conversions
+void arena_reset(raster_arena* arena);
+
+void* arena_alloc(raster_arena* arena, size_t size);
+// old_size is the size ptr was allocated with, like STBI_REALLOC_SIZED passes it
+void* arena_realloc(raster_arena* arena, void* ptr, size_t old_size, size_t size);
+void arena_free(raster_arena* arena, void* ptr);
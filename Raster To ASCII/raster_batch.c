@@ -0,0 +1,298 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include "time.h"
+
+#include <threads.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include "raster_batch.h"
+#include "raster_map.h"
+#include "raster_parallel.h"
+
+// paths are claimed one at a time so a few huge images don't leave other workers idle
+typedef struct {
+    batch_paths* paths;
+    raster_options options;
+    int next;
+    mtx_t lock;
+} batch_queue;
+
+// lives for the whole run, buffers only ever grow and the context keeps every conversion buffer warm
+typedef struct {
+    batch_queue* queue;
+    raster_context* context;
+    unsigned char* input; // only for files that can't be mapped
+    size_t input_capacity;
+    char* out_name;
+    size_t out_name_capacity;
+    int converted;
+    int failed;
+    unsigned long long pixels;
+    unsigned long long chars;
+    unsigned long long bytes_read;
+} batch_worker;
+
+static char* copy_string(const char* str, size_t len) {
+    char* copy = malloc(len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+static void add_path(batch_paths* paths, const char* path, size_t len) {
+    if(paths->count == paths->capacity) {
+        paths->capacity = paths->capacity ? paths->capacity * 2 : 64;
+        paths->items = realloc(paths->items, sizeof(char*) * paths->capacity);
+    }
+    paths->items[paths->count++] = copy_string(path, len);
+}
+
+static int has_image_extension(const char* name) {
+    static const char* extensions[] = {".jpg", ".jpeg", ".png", ".bmp", ".tga", ".gif", ".psd", ".hdr", ".pic", ".pnm", ".ppm", ".pgm"};
+    const char* dot = strrchr(name, '.');
+    if(dot == NULL) {
+        return 0;
+    }
+    for(size_t i=0;i<sizeof(extensions)/sizeof(extensions[0]);i++) {
+        const char* a = dot;
+        const char* b = extensions[i];
+        while(*a && *b && (*a | 0x20) == *b) { // ascii lowercase compare, '.' is unaffected
+            a++;
+            b++;
+        }
+        if(*a == '\0' && *b == '\0') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void add_joined(batch_paths* paths, const char* dir, const char* name) {
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    char* path = malloc(dir_len + name_len + 2);
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+    add_path(paths, path, dir_len + name_len + 1);
+    free(path);
+}
+
+// returns 0 if input is not a directory
+static int add_directory(batch_paths* paths, const char* dir) {
+#ifdef _WIN32
+    size_t dir_len = strlen(dir);
+    char* pattern = malloc(dir_len + 3);
+    memcpy(pattern, dir, dir_len);
+    memcpy(pattern + dir_len, "/*", 3);
+    WIN32_FIND_DATAA found;
+    HANDLE handle = FindFirstFileA(pattern, &found);
+    free(pattern);
+    if(handle == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    do {
+        if(!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && has_image_extension(found.cFileName)) {
+            add_joined(paths, dir, found.cFileName);
+        }
+    } while(FindNextFileA(handle, &found));
+    FindClose(handle);
+    return 1;
+#else
+    DIR* handle = opendir(dir);
+    if(handle == NULL) {
+        return 0;
+    }
+    struct dirent* entry;
+    while((entry = readdir(handle)) != NULL) {
+        if(entry->d_name[0] != '.' && has_image_extension(entry->d_name)) {
+            add_joined(paths, dir, entry->d_name);
+        }
+    }
+    closedir(handle);
+    return 1;
+#endif
+}
+
+static void add_stdin_list(batch_paths* paths) {
+    char line[4096];
+    while(fgets(line, sizeof(line), stdin) != NULL) {
+        size_t len = strcspn(line, "\r\n");
+        if(len > 0) {
+            add_path(paths, line, len);
+        }
+    }
+}
+
+void batch_add_input(batch_paths* paths, const char* input) {
+    if(strcmp(input, "-") == 0) {
+        add_stdin_list(paths);
+    }else if(!add_directory(paths, input)) {
+        add_path(paths, input, strlen(input));
+    }
+}
+
+void batch_free_paths(batch_paths* paths) {
+    for(int i=0;i<paths->count;i++) {
+        free(paths->items[i]);
+    }
+    free(paths->items);
+    paths->items = NULL;
+    paths->count = paths->capacity = 0;
+}
+
+static int read_file(batch_worker* worker, const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if(length <= 0) {
+        fclose(file);
+        return -1;
+    }
+    if(worker->input_capacity < (size_t)length) {
+        free(worker->input);
+        worker->input = malloc(length);
+        worker->input_capacity = length;
+    }
+    *size = fread(worker->input, 1, length, file);
+    fclose(file);
+    return *size == (size_t)length ? 0 : -1;
+}
+
+static int convert_one(batch_worker* worker, const char* path) {
+    raster_map map = {NULL, 0};
+    const unsigned char* input;
+    size_t input_size;
+    if(map_file(path, &map) == 0) {
+        input = map.data;
+        input_size = map.size;
+    }else if(read_file(worker, path, &input_size) == 0) {
+        input = worker->input;
+    }else {
+        return -1;
+    }
+    int width, height, channels;
+    const char* frame;
+    size_t frame_size;
+    int status = raster_memory_info(input, input_size, &width, &height, &channels);
+    if(status == RASTER_OK) {
+        status = raster_context_from_memory(worker->context, input, input_size, worker->queue->options, &frame, &frame_size);
+    }
+    unmap_file(&map); // the frame lives in the context
+    if(status != RASTER_OK) {
+        return -1;
+    }
+
+    size_t path_len = strlen(path);
+    if(worker->out_name_capacity < path_len + sizeof(".out.txt")) {
+        free(worker->out_name);
+        worker->out_name_capacity = path_len + sizeof(".out.txt");
+        worker->out_name = malloc(worker->out_name_capacity);
+    }
+    memcpy(worker->out_name, path, path_len);
+    memcpy(worker->out_name + path_len, ".out.txt", sizeof(".out.txt"));
+    FILE* file_out = fopen(worker->out_name, "w");
+    if(file_out == NULL) {
+        return -1;
+    }
+    fwrite(frame, 1, frame_size, file_out);
+    fclose(file_out);
+
+    worker->pixels += (unsigned long long)width * height;
+    worker->chars += frame_size;
+    worker->bytes_read += input_size;
+    return 0;
+}
+
+static int batch_worker_thread(void* arg) {
+    batch_worker* worker = arg;
+    batch_queue* queue = worker->queue;
+    for(;;) {
+        mtx_lock(&queue->lock);
+        int index = queue->next++;
+        mtx_unlock(&queue->lock);
+        if(index >= queue->paths->count) {
+            break;
+        }
+        if(convert_one(worker, queue->paths->items[index]) == 0) {
+            worker->converted++;
+        }else {
+            worker->failed++;
+            fprintf(stderr, "Failed to convert \"%s\"\n", queue->paths->items[index]);
+        }
+    }
+    return 0;
+}
+
+static double seconds_now(void) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (double)now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+int run_batch(batch_paths* paths, raster_options options, int workers) {
+    workers = resolve_threads(workers);
+    if(workers > paths->count) {
+        workers = paths->count > 0 ? paths->count : 1;
+    }
+    options.threads = 1; // parallel across images instead of inside them
+    options.stats = NULL; // the workers would all add to the same one
+
+    batch_queue queue = {paths, options, 0};
+    mtx_init(&queue.lock, mtx_plain);
+    batch_worker* pool = calloc(workers, sizeof(batch_worker));
+    thrd_t* handles = malloc(sizeof(thrd_t) * workers);
+    char* started = calloc(workers, sizeof(char));
+
+    double start = seconds_now();
+    for(int t=0;t<workers;t++) {
+        pool[t].queue = &queue;
+        pool[t].context = raster_context_create();
+        if(t > 0) {
+            started[t] = thrd_create(&handles[t], batch_worker_thread, &pool[t]) == thrd_success;
+        }
+    }
+    batch_worker_thread(&pool[0]);
+    for(int t=1;t<workers;t++) {
+        if(started[t]) {
+            thrd_join(handles[t], NULL);
+        }
+    }
+    double elapsed = seconds_now() - start;
+
+    batch_worker total = {0};
+    for(int t=0;t<workers;t++) {
+        total.converted += pool[t].converted;
+        total.failed += pool[t].failed;
+        total.pixels += pool[t].pixels;
+        total.chars += pool[t].chars;
+        total.bytes_read += pool[t].bytes_read;
+        free(pool[t].input);
+        free(pool[t].out_name);
+        raster_context_destroy(pool[t].context);
+    }
+    if(elapsed <= 0) {
+        elapsed = 1e-9;
+    }
+    printf("Batch: %d converted, %d failed, %d workers, %.3f s\n", total.converted, total.failed, workers, elapsed);
+    printf("Throughput: %.1f images/s, %.2f MB/s read, %.1f megapixels/s, %.1f million chars/s\n",
+           total.converted / elapsed, total.bytes_read / elapsed * 1e-6, total.pixels / elapsed * 1e-6, total.chars / elapsed * 1e-6);
+
+    free(started);
+    free(handles);
+    free(pool);
+    mtx_destroy(&queue.lock);
+    return total.failed;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "image_raster.h"
+
+typedef struct {
+    char** items;
+    int count;
+    int capacity;
+} batch_paths;
+
+// a directory adds the image files directly inside it, "-" adds one path per line read from stdin,
+// anything else is added as is
+void batch_add_input(batch_paths* paths, const char* input);
+void batch_free_paths(batch_paths* paths);
+
+// converts every path to "<path>.out.txt" on a pool of workers threads (< 1 uses every hardware thread),
+// each image is rasterized single-threaded with the rest of options, prints a throughput summary at the end;
+// returns the number of images that failed
+int run_batch(batch_paths* paths, raster_options options, int workers);
@@ -0,0 +1,302 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include "limits.h"
+
+#include "raster_bench.h"
+#include "raster_map.h"
+#include "raster_parallel.h"
+#include "raster_stats.h"
+
+enum { STAGE_DECODE, STAGE_LUMINANCE, STAGE_REDUCTION, STAGE_OUTPUT, STAGE_TOTAL, STAGE_COUNT };
+static const char* stage_names[STAGE_COUNT] = {"decode", "luminance", "reduction", "output", "total"};
+
+int bench_parse_list(const char* text, int* values, int capacity) {
+    int count = 0;
+    for(;;) {
+        char* end;
+        long value = strtol(text, &end, 10);
+        if(end == text || value < INT_MIN || value > INT_MAX || count == capacity) {
+            return -1;
+        }
+        values[count++] = (int)value;
+        if(*end == '\0') {
+            return count;
+        }
+        if(*end != ',') {
+            return -1;
+        }
+        text = end + 1;
+    }
+}
+
+int bench_parse_size(const char* text, int* width, int* height) {
+    char* end;
+    long w = strtol(text, &end, 10);
+    if(end == text || (*end != 'x' && *end != 'X')) {
+        return -1;
+    }
+    text = end + 1;
+    long h = strtol(text, &end, 10);
+    if(end == text || *end != '\0' || w < 0 || h < 0 || w > INT_MAX || h > INT_MAX) {
+        return -1;
+    }
+    *width = (int)w;
+    *height = (int)h;
+    return 0;
+}
+
+static double seconds_now(void) {
+    return stats_now_ns() * 1e-9;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// sorted holds count values in ascending order, p in [0, 1], interpolates between the two closest ranks
+static double percentile(const double* sorted, int count, double p) {
+    double rank = p * (count - 1);
+    int low = (int)rank;
+    if(low + 1 >= count) {
+        return sorted[count - 1];
+    }
+    return sorted[low] + (sorted[low + 1] - sorted[low]) * (rank - low);
+}
+
+static void put_u32(unsigned char* out, unsigned int value) {
+    out[0] = (unsigned char)(value >> 24);
+    out[1] = (unsigned char)(value >> 16);
+    out[2] = (unsigned char)(value >> 8);
+    out[3] = (unsigned char)value;
+}
+
+static unsigned int crc32(const unsigned char* data, size_t size) {
+    static unsigned int table[256];
+    if(table[1] == 0) {
+        for(unsigned int n=0;n<256;n++) {
+            unsigned int c = n;
+            for(int k=0;k<8;k++) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+    }
+    unsigned int c = 0xffffffffu;
+    for(size_t i=0;i<size;i++) {
+        c = table[(c ^ data[i]) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffffu;
+}
+
+// chunk data must already sit at out + 8, returns the size of the whole chunk
+static size_t finish_chunk(unsigned char* out, const char* type, size_t size) {
+    put_u32(out, (unsigned int)size);
+    memcpy(out + 4, type, 4);
+    put_u32(out + 8 + size, crc32(out + 4, size + 4));
+    return size + 12;
+}
+
+// pixels as a PNG with filter 0 rows in stored (uncompressed) deflate blocks, NULL if it would be too big
+static unsigned char* encode_png(const unsigned char* pixels, int width, int height, int channels, size_t* size) {
+    static const unsigned char color_types[5] = {0, 0, 4, 2, 6};
+    size_t row = (size_t)width * channels + 1;
+    size_t raw = row * height;
+    size_t blocks = raw / 65535 + 1;
+    size_t zlib = 2 + raw + 5 * blocks + 4;
+    *size = 8 + 25 + 12 + zlib + 12;
+    if(zlib > INT_MAX || *size > INT_MAX) {
+        return NULL;
+    }
+    unsigned char* png = malloc(*size);
+    unsigned char* out = png;
+    memcpy(out, "\x89PNG\r\n\x1a\n", 8);
+    out += 8;
+    put_u32(out + 8, width);
+    put_u32(out + 12, height);
+    out[16] = 8;
+    out[17] = color_types[channels];
+    out[18] = out[19] = out[20] = 0;
+    out += finish_chunk(out, "IHDR", 13);
+
+    unsigned char* z = out + 8;
+    *z++ = 0x78;
+    *z++ = 0x01;
+    unsigned int a = 1, b = 0;
+    size_t left = raw;
+    size_t pos = 0; // position in the filtered stream, every row starts with its filter byte
+    while(left > 0) {
+        unsigned int len = left > 65535 ? 65535 : (unsigned int)left;
+        left -= len;
+        *z++ = left == 0;
+        z[0] = (unsigned char)len;
+        z[1] = (unsigned char)(len >> 8);
+        z[2] = (unsigned char)~len;
+        z[3] = (unsigned char)(~len >> 8);
+        z += 4;
+        for(unsigned int i=0;i<len;i++, pos++) {
+            size_t x = pos % row;
+            unsigned char value = x == 0 ? 0 : pixels[pos / row * (row - 1) + x - 1];
+            *z++ = value;
+            a = (a + value) % 65521;
+            b = (b + a) % 65521;
+        }
+    }
+    put_u32(z, (b << 16) | a);
+    z += 4;
+    out += finish_chunk(out, "IDAT", z - (out + 8));
+    out += finish_chunk(out, "IEND", 0);
+    *size = out - png;
+    return png;
+}
+
+// smooth gradients in every channel with a little noise on top, so blocks differ and the ramp is spread out
+static unsigned char* synthetic_pixels(int width, int height, int channels) {
+    unsigned char* pixels = malloc((size_t)width * height * channels);
+    unsigned int state = 0x9e3779b9u;
+    unsigned char* p = pixels;
+    for(int y=0;y<height;y++) {
+        for(int x=0;x<width;x++) {
+            for(int c=0;c<channels;c++) {
+                state ^= state << 13;
+                state ^= state >> 17;
+                state ^= state << 5;
+                int value = c == 3 ? 192 + (int)(state & 63) // alpha stays mostly opaque
+                                   : (int)((unsigned long long)(x + y * (c + 1)) * 224 / ((unsigned long long)width + height * (c + 1))) + (int)(state & 31);
+                *p++ = (unsigned char)value;
+            }
+        }
+    }
+    return pixels;
+}
+
+// one image through every configuration; returns 0 if it decoded
+static int bench_image(const char* name, const unsigned char* encoded, size_t encoded_size,
+                       const bench_config* config, raster_options options, FILE* sink) {
+    int width, height, channels;
+    if(raster_memory_info(encoded, encoded_size, &width, &height, &channels) != RASTER_OK) {
+        fprintf(stderr, "Failed to load \"%s\"\n", name);
+        return -1;
+    }
+    printf("%s: %dx%d, %d channels, %llu bytes encoded\n", name, width, height, channels, (unsigned long long)encoded_size);
+    printf("%7s %7s  %-10s %10s %10s %10s %10s %10s\n", "sample", "threads", "stage", "median ms", "p10 ms", "p90 ms", "MP/s", "Mchars/s");
+    double megapixels = (double)width * height * 1e-6;
+    double* times = malloc(sizeof(double) * STAGE_COUNT * config->runs);
+    char* frame = NULL;
+    size_t frame_capacity = 0;
+    int status = RASTER_OK;
+    for(int s=0;s<config->sample_size_count && status == RASTER_OK;s++) {
+        for(int t=0;t<config->thread_count && status == RASTER_OK;t++) {
+            size_t frame_size = 0;
+            for(int run=-1;run<config->runs;run++) { // run -1 warms up caches, the sink and the glyph table
+                raster_options run_options = options;
+                run_options.sample_size = config->sample_sizes[s];
+                run_options.threads = config->threads[t];
+                image img;
+                double start = seconds_now();
+                status = raster_decode(encoded, encoded_size, &run_options, &img);
+                if(status != RASTER_OK) {
+                    break;
+                }
+                double decoded = seconds_now();
+                raster_image_brightness(&img, run_options);
+                double converted = seconds_now();
+                size_t frame_bound = raster_frame_bound(img.width, img.height, run_options);
+                if(frame_capacity < frame_bound) {
+                    free(frame);
+                    frame = malloc(frame_bound);
+                    frame_capacity = frame_bound;
+                }
+                double reduce_start = seconds_now();
+                frame_size = rasterize_frame(&img, run_options, frame);
+                double reduced = seconds_now();
+                rewind(sink);
+                fwrite(frame, 1, frame_size, sink);
+                fflush(sink);
+                double written = seconds_now();
+                raster_free_image(&img);
+                if(run >= 0) {
+                    double* sample = times + STAGE_COUNT * run;
+                    sample[STAGE_DECODE] = decoded - start;
+                    sample[STAGE_LUMINANCE] = converted - decoded;
+                    sample[STAGE_REDUCTION] = reduced - reduce_start;
+                    sample[STAGE_OUTPUT] = written - reduced;
+                    sample[STAGE_TOTAL] = sample[STAGE_DECODE] + sample[STAGE_LUMINANCE] + sample[STAGE_REDUCTION] + sample[STAGE_OUTPUT];
+                }
+            }
+            if(status != RASTER_OK) {
+                break;
+            }
+            double* sorted = malloc(sizeof(double) * config->runs);
+            for(int stage=0;stage<STAGE_COUNT;stage++) {
+                for(int run=0;run<config->runs;run++) {
+                    sorted[run] = times[STAGE_COUNT * run + stage];
+                }
+                qsort(sorted, config->runs, sizeof(double), compare_doubles);
+                double median = percentile(sorted, config->runs, 0.5);
+                double seconds = median > 0 ? median : 1e-9;
+                printf("%7d %7d  %-10s %10.3f %10.3f %10.3f %10.1f %10.1f\n", config->sample_sizes[s], resolve_threads(config->threads[t]),
+                       stage_names[stage], median * 1e3, percentile(sorted, config->runs, 0.1) * 1e3, percentile(sorted, config->runs, 0.9) * 1e3,
+                       megapixels / seconds, frame_size / seconds * 1e-6);
+            }
+            free(sorted);
+        }
+    }
+    printf("\n");
+    free(frame);
+    free(times);
+    if(status != RASTER_OK) {
+        fprintf(stderr, "Failed to convert \"%s\"\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+int run_bench(const bench_config* config, batch_paths* files, raster_options options) {
+    FILE* sink = tmpfile(); // the output stage writes here, the frame never reaches a terminal
+    if(sink == NULL) {
+        fprintf(stderr, "Failed to create a temporary file for the output stage\n");
+        return files->count > 0 ? files->count : 1;
+    }
+    options.stats = NULL; // the bench keeps its own times
+    printf("Bench: %d runs per configuration, kernels: %s%s\n\n", config->runs, get_raster_kernels(options.simd)->name,
+           options.fixed_point ? ", fixed point" : "");
+
+    int failed = 0;
+    for(int c=0;c<config->channel_count && config->width > 0 && config->height > 0;c++) {
+        int channels = config->channels[c];
+        if(channels < 1 || channels > 4) {
+            fprintf(stderr, "Synthetic images have 1 to 4 channels, not %d\n", channels);
+            failed++;
+            continue;
+        }
+        size_t encoded_size;
+        unsigned char* pixels = synthetic_pixels(config->width, config->height, channels);
+        unsigned char* encoded = encode_png(pixels, config->width, config->height, channels, &encoded_size);
+        free(pixels);
+        char name[64];
+        snprintf(name, sizeof(name), "synthetic %dx%dx%d", config->width, config->height, channels);
+        if(encoded == NULL) {
+            fprintf(stderr, "Synthetic image %dx%dx%d is too big for one PNG\n", config->width, config->height, channels);
+            failed++;
+            continue;
+        }
+        failed += bench_image(name, encoded, encoded_size, config, options, sink) != 0;
+        free(encoded);
+    }
+
+    for(int i=0;i<files->count;i++) {
+        raster_map map;
+        if(map_file(files->items[i], &map) != 0) {
+            fprintf(stderr, "Failed to read \"%s\"\n", files->items[i]);
+            failed++;
+            continue;
+        }
+        failed += bench_image(files->items[i], map.data, map.size, config, options, sink) != 0;
+        unmap_file(&map);
+    }
+    fclose(sink);
+    return failed;
+}
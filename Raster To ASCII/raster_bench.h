@@ -0,0 +1,31 @@
+#pragma once
+
+#include "image_raster.h"
+#include "raster_batch.h"
+
+#define BENCH_MAX_LIST 16
+
+typedef struct {
+    // synthetic images, one per channel count, skipped if width or height is 0
+    int width;
+    int height;
+    int channels[BENCH_MAX_LIST];
+    int channel_count;
+    int sample_sizes[BENCH_MAX_LIST];
+    int sample_size_count;
+    int threads[BENCH_MAX_LIST]; // < 1 uses every hardware thread
+    int thread_count;
+    int runs; // timed runs per configuration, after one untimed warm-up
+} bench_config;
+
+// "1,2,4" into values, returns how many were read or -1 if text isn't such a list
+int bench_parse_list(const char* text, int* values, int capacity);
+// "1920x1080", returns 0 on success
+int bench_parse_size(const char* text, int* width, int* height);
+
+// Times decode, luminance conversion, block reduction and output separately for every image, sample size
+// and thread count, and prints median, 10th and 90th percentile per stage with throughput in megapixels/s
+// (of the source image) and characters/s. Synthetic images are uncompressed PNGs of smooth gradients plus
+// noise, so their decode is mostly defiltering; files (real corpora, see batch_add_input) are read into
+// memory once. The rest of options applies as is. Returns the number of files that failed.
+int run_bench(const bench_config* config, batch_paths* files, raster_options options);
@@ -0,0 +1,271 @@
+#include "string.h"
+
+#include "raster_color.h"
+
+// the longest escapes each mode writes, "\x1b[38;2;255;255;255m" and "\x1b[38;5;255m"
+#define COLOR_TRUE_ESCAPE 19
+#define COLOR_256_ESCAPE 11
+#define COLOR_RESET "\x1b[0m"
+#define COLOR_RESET_SIZE 4
+
+void color_band_alloc(color_band* band, raster_arena* arena, const raster_kernels* kernels, int width, int channels, int sample_size) {
+    size_t values = (size_t)width * channels;
+    band->kernels = kernels;
+    band->width = width;
+    band->channels = channels;
+    band->sample_size = sample_size;
+    band->x_len = (width-1)/sample_size + 1;
+    band->cols = arena_alloc(arena, sizeof(unsigned short) * (values + 1));
+    band->premultiplied = channels == 2 || channels == 4 ? arena_alloc(arena, values) : NULL;
+    band->block = arena_alloc(arena, sizeof(unsigned int) * band->x_len);
+    band->cells = arena_alloc(arena, sizeof(unsigned long long) * 3 * band->x_len);
+    memset(band->cols, 0, sizeof(unsigned short) * (values + 1));
+    memset(band->cells, 0, sizeof(unsigned long long) * 3 * band->x_len);
+    band->rows = 0;
+    band->band_rows = 0;
+}
+
+void color_band_free(color_band* band, raster_arena* arena) {
+    arena_free(arena, band->cells);
+    arena_free(arena, band->block);
+    arena_free(arena, band->premultiplied);
+    arena_free(arena, band->cols);
+}
+
+// rounds c*alpha/255 exactly
+static inline unsigned char premultiply(unsigned int value, unsigned int alpha) {
+    unsigned int product = value * alpha + 128;
+    return (unsigned char)((product + (product >> 8)) >> 8);
+}
+
+// the column sums into the cell sums, one channel at a time straight from the interleaved columns,
+// then the columns start over; gray only fills red, color_band_average copies it
+static void flush(color_band* band) {
+    int components = band->channels < 3 ? 1 : 3;
+    for(int c=0;c<components;c++) {
+        band->kernels->block_sum_u16(band->cols + c, band->block, band->width, band->sample_size, band->channels);
+        for(int i=0;i<band->x_len;i++) {
+            band->cells[3*i + c] += band->block[i];
+        }
+    }
+    memset(band->cols, 0, sizeof(unsigned short) * band->width * band->channels);
+    band->rows = 0;
+}
+
+void color_band_add(color_band* band, const unsigned char* row) {
+    int values = band->width * band->channels;
+    if(band->premultiplied != NULL) {
+        int alpha = band->channels - 1;
+        for(int x=0;x<values;x+=band->channels) {
+            for(int c=0;c<alpha;c++) {
+                band->premultiplied[x + c] = premultiply(row[x + c], row[x + alpha]);
+            }
+            band->premultiplied[x + alpha] = 0;
+        }
+        row = band->premultiplied;
+    }
+    if(band->rows == COLOR_FLUSH_ROWS) {
+        flush(band);
+    }
+    band->kernels->column_sum_u8(row, band->cols, values);
+    band->rows++;
+    band->band_rows++;
+}
+
+// a cell's average is sum/count rounded, as (sum * reciprocal + 2^31) >> 32 with reciprocal = 2^32/count: sums of
+// up to 255*count stay far from overflowing and the result is within rounding of the exact average
+static inline unsigned long long average_reciprocal(unsigned long long count) {
+    return ((1ull << 32) + count/2) / count;
+}
+
+static inline void average_cell(const unsigned long long* sums, int gray, unsigned long long reciprocal, unsigned char* dst) {
+    for(int c=0;c<3;c++) {
+        dst[c] = (unsigned char)((sums[gray ? 0 : c] * reciprocal + (1ull << 31)) >> 32);
+    }
+}
+
+void color_band_average(color_band* band, unsigned char* dst) {
+    int gray = band->channels < 3;
+    if(band->sample_size == 1) { // every cell is one pixel of the single row in cols
+        for(int i=0;i<band->x_len;i++) {
+            const unsigned short* pixel = band->cols + (size_t)i * band->channels;
+            dst[3*i] = (unsigned char)pixel[0];
+            dst[3*i + 1] = (unsigned char)pixel[gray ? 0 : 1];
+            dst[3*i + 2] = (unsigned char)pixel[gray ? 0 : 2];
+        }
+        memset(band->cols, 0, sizeof(unsigned short) * band->width * band->channels);
+        band->rows = 0;
+        band->band_rows = 0;
+        return;
+    }
+    flush(band);
+    int last = band->x_len - 1;
+    unsigned long long reciprocal = average_reciprocal((unsigned long long)band->sample_size * band->band_rows);
+    unsigned long long last_reciprocal = average_reciprocal((unsigned long long)(band->width - last*band->sample_size) * band->band_rows);
+    const unsigned long long* cells = band->cells;
+    for(int i=0;i<last;i++) {
+        average_cell(cells + 3*i, gray, reciprocal, dst + 3*i);
+    }
+    average_cell(cells + 3*last, gray, last_reciprocal, dst + 3*last);
+    memset(band->cells, 0, sizeof(unsigned long long) * 3 * band->x_len);
+    band->band_rows = 0;
+}
+
+// xterm's 6x6x6 cube has the levels 0, 95, 135, 175, 215 and 255; this is the nearest one
+static inline int cube_step(int value) {
+    return value < 48 ? 0 : value < 115 ? 1 : (value - 35) / 40;
+}
+
+static inline int cube_level(int step) {
+    return step == 0 ? 0 : 55 + step*40;
+}
+
+static inline int distance(const unsigned char* rgb, int r, int g, int b) {
+    return (rgb[0] - r)*(rgb[0] - r) + (rgb[1] - g)*(rgb[1] - g) + (rgb[2] - b)*(rgb[2] - b);
+}
+
+// nearest of the cube (16..231) and the gray ramp (232..255, levels 8, 18, ... 238)
+static int palette_index(const unsigned char* rgb) {
+    int r = cube_step(rgb[0]);
+    int g = cube_step(rgb[1]);
+    int b = cube_step(rgb[2]);
+    int cube_distance = distance(rgb, cube_level(r), cube_level(g), cube_level(b));
+    int mean = (rgb[0] + rgb[1] + rgb[2] + 1) / 3;
+    int gray = mean < 8 ? 0 : (mean - 3) / 10;
+    gray = gray < 23 ? gray : 23;
+    int level = 8 + gray*10;
+    if(distance(rgb, level, level, level) < cube_distance) {
+        return 232 + gray;
+    }
+    return 16 + 36*r + 6*g + b;
+}
+
+// what the terminal shows for a palette_index
+static void palette_rgb(int index, int* rgb) {
+    if(index >= 232) {
+        rgb[0] = rgb[1] = rgb[2] = 8 + (index - 232)*10;
+        return;
+    }
+    index -= 16;
+    rgb[0] = cube_level(index / 36);
+    rgb[1] = cube_level(index / 6 % 6);
+    rgb[2] = cube_level(index % 6);
+}
+
+// the color a cell is written in: the 24-bit color or the palette entry
+static inline int quantize(const unsigned char* rgb, raster_color color) {
+    if(color == RASTER_COLOR_TRUE) {
+        return rgb[0] << 16 | rgb[1] << 8 | rgb[2];
+    }
+    return palette_index(rgb);
+}
+
+// whether a cell can stay in the color the terminal shows, code as quantize returns it
+static int close_to(const unsigned char* rgb, int code, raster_color color, int tolerance) {
+    int shown[3];
+    if(color == RASTER_COLOR_TRUE) {
+        shown[0] = code >> 16;
+        shown[1] = code >> 8 & 255;
+        shown[2] = code & 255;
+    }else {
+        palette_rgb(code, shown);
+    }
+    for(int c=0;c<3;c++) {
+        int difference = rgb[c] - shown[c];
+        if(difference > tolerance || difference < -tolerance) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static char* put_decimal(char* out, int value) {
+    if(value >= 100) {
+        *out++ = (char)('0' + value/100);
+    }
+    if(value >= 10) {
+        *out++ = (char)('0' + value/10%10);
+    }
+    *out++ = (char)('0' + value%10);
+    return out;
+}
+
+static size_t put_escape(char* out, int code, raster_color color) {
+    char* p = out;
+    memcpy(p, "\x1b[38;", 5);
+    p += 5;
+    if(color == RASTER_COLOR_TRUE) {
+        *p++ = '2';
+        *p++ = ';';
+        p = put_decimal(p, code >> 16);
+        *p++ = ';';
+        p = put_decimal(p, code >> 8 & 255);
+        *p++ = ';';
+        p = put_decimal(p, code & 255);
+    }else {
+        *p++ = '5';
+        *p++ = ';';
+        p = put_decimal(p, code);
+    }
+    *p++ = 'm';
+    return p - out;
+}
+
+size_t color_line_bound(int x_len, raster_color color) {
+    size_t escape = color == RASTER_COLOR_TRUE ? COLOR_TRUE_ESCAPE : COLOR_256_ESCAPE;
+    return (size_t)x_len * (escape + 1) + COLOR_RESET_SIZE + 1;
+}
+
+size_t color_line(const char* glyphs, const unsigned char* colors, int x_len, raster_color color, int tolerance,
+                  int* current, int last, char* out) {
+    size_t size = 0;
+    for(int i=0;i<x_len;i++) {
+        if(glyphs[i] != ' ') { // a space looks the same in any color
+            const unsigned char* rgb = colors + 3*i;
+            int code = tolerance > 0 && *current >= 0 && close_to(rgb, *current, color, tolerance) ? *current : quantize(rgb, color);
+            if(code != *current) {
+                char escape[COLOR_TRUE_ESCAPE];
+                size += put_escape(out != NULL ? out + size : escape, code, color);
+                *current = code;
+            }
+        }
+        if(out != NULL) {
+            out[size] = glyphs[i];
+        }
+        size++;
+    }
+    if(last && *current >= 0) {
+        if(out != NULL) {
+            memcpy(out + size, COLOR_RESET, COLOR_RESET_SIZE);
+        }
+        size += COLOR_RESET_SIZE;
+        *current = -1;
+    }
+    if(out != NULL) {
+        out[size] = '\n';
+    }
+    return size + 1;
+}
+
+size_t color_frame(const char* grid, const unsigned char* colors, int x_len, int y_len, raster_color color, int tolerance,
+                   char* out, size_t capacity, char* spill) {
+    size_t size = 0;
+    size_t line_bound = color_line_bound(x_len, color);
+    int current = -1;
+    for(int j=0;j<y_len;j++) {
+        const char* glyphs = grid + (size_t)j * (x_len + 1);
+        const unsigned char* line_colors = colors + (size_t)j * x_len * 3;
+        int last = j == y_len - 1;
+        if(size <= capacity && capacity - size >= line_bound) {
+            size += color_line(glyphs, line_colors, x_len, color, tolerance, &current, last, out + size);
+            continue;
+        }
+        // past what surely fits: the line goes to spill and is copied if it does, afterwards lines are only counted
+        size_t line_size = color_line(glyphs, line_colors, x_len, color, tolerance, &current, last, size <= capacity ? spill : NULL);
+        if(size <= capacity && capacity - size >= line_size) {
+            memcpy(out + size, spill, line_size);
+        }
+        size += line_size;
+    }
+    return size;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "stddef.h"
+
+#include "image_raster.h"
+#include "raster_arena.h"
+
+// Color sums of one band, one per thread. Every row's bytes go into 16-bit column sums with the column_sum_u8
+// kernel, interleaved like the pixels (gray+alpha and rgba rows get their alpha multiplied in first). At the end
+// of the band, and every COLOR_FLUSH_ROWS rows before 16 bits could overflow, block_sum_u16 sums each channel
+// of those with the channel count as its stride into 64-bit sums per cell, so bands of any height fit.
+#define COLOR_FLUSH_ROWS 257
+
+typedef struct {
+    const raster_kernels* kernels;
+    int width;
+    int channels;
+    int sample_size;
+    int x_len;
+    unsigned short* cols;         // width*channels + 1 since block_sum_u16 reads one past, zero at the start of a band
+    unsigned char* premultiplied; // width*channels, a row times its alpha, NULL without alpha
+    unsigned int* block;          // x_len block sums of one channel
+    unsigned long long* cells;    // 3*x_len rgb sums of the band
+    int rows;                     // rows in cols since the last flush
+    int band_rows;                // rows in the band
+} color_band;
+
+void color_band_alloc(color_band* band, raster_arena* arena, const raster_kernels* kernels, int width, int channels, int sample_size);
+void color_band_free(color_band* band, raster_arena* arena);
+
+void color_band_add(color_band* band, const unsigned char* row);
+
+// rgb of every cell of the band, rounded, 3 bytes per cell; the sums start over for the next band
+void color_band_average(color_band* band, unsigned char* dst);
+
+// bytes one line of x_len cells takes at most, the '\n' and the reset of a frame's last line included
+size_t color_line_bound(int x_len, raster_color color);
+
+// One line of glyphs with their cell colors: a color escape is written only where a cell's color differs from
+// *current (the color the terminal is in, -1 before the first one), or with a tolerance > 0 where one of its channels
+// is further than that from it; spaces never change it. The last line of a frame ends with a reset so the terminal
+// is left as it was. Returns the bytes, out NULL only counts them.
+size_t color_line(const char* glyphs, const unsigned char* colors, int x_len, raster_color color, int tolerance,
+                  int* current, int last, char* out);
+
+// color_line over a frame's grid (lines of x_len glyphs and '\n') and its cell colors in a single pass: lines are
+// written to out while they fit in capacity and counted after that. spill (color_line_bound bytes) takes a line
+// that might not fit, it may be NULL when capacity holds the frame's bound. Returns the frame's size.
+size_t color_frame(const char* grid, const unsigned char* colors, int x_len, int y_len, raster_color color, int tolerance,
+                   char* out, size_t capacity, char* spill);
@@ -0,0 +1,42 @@
+#include "raster_dither.h"
+
+void dither_cells(const raster_glyphs* glyphs, raster_dither dither, const float* means, const float* errors,
+                  float* below, float* below2, int x_len, int begin, int end, dither_carry* carry, char* line) {
+    int steps = glyphs->length - 1;
+    int per_glyph = glyphs->levels / glyphs->length;
+    float step_value = steps > 0 ? 1.f / steps : 0.f;
+    int last = x_len - 1;
+    float right = carry->right; // in registers, the stores to below could alias carry
+    float right2 = carry->right2;
+    for(int i=begin;i<end;i++) {
+        float value = means[i] + (errors[i] + right);
+        value = value < 0.f ? 0.f : value > 1.f ? 1.f : value;
+        int step = (int)(value * steps + 0.5f); // nearest level, the ramp's ends are pure white and black
+        line[i] = glyphs->table[step * per_glyph];
+        float error = value - step * step_value;
+        if(dither == RASTER_DITHER_FLOYD_STEINBERG) {
+            right = error * (7.f/16);
+            if(i > 0) {
+                below[i-1] += error * (3.f/16);
+            }
+            below[i] += error * (5.f/16);
+            if(i < last) {
+                below[i+1] += error * (1.f/16);
+            }
+        }else {
+            float share = error * (1.f/8);
+            right = right2 + share;
+            right2 = share;
+            if(i > 0) {
+                below[i-1] += share;
+            }
+            below[i] += share;
+            if(i < last) {
+                below[i+1] += share;
+            }
+            below2[i] += share;
+        }
+    }
+    carry->right = right;
+    carry->right2 = right2;
+}
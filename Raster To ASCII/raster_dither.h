@@ -0,0 +1,16 @@
+#pragma once
+
+#include "image_raster.h"
+#include "raster_glyphs.h"
+
+// what a row carries along to the cells right of the current one
+typedef struct {
+    float right;
+    float right2;
+} dither_carry;
+
+// Cells begin..end of one row of x_len cell averages, left to right: errors is what the rows above pushed into
+// them, below and below2 (x_len each) get this row's share for the next two rows. The row's own error travels
+// in carry, zero it at the start of a row, so nothing else of the row is written while the rows below read it.
+void dither_cells(const raster_glyphs* glyphs, raster_dither dither, const float* means, const float* errors,
+                  float* below, float* below2, int x_len, int begin, int end, dither_carry* carry, char* line);
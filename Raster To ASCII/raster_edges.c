@@ -0,0 +1,41 @@
+#include "stddef.h"
+
+#include "raster_edges.h"
+
+// A step of contrast c adds 32*c^2 per row to the cell it crosses, so mean gx^2+gy^2 per pixel times the cell
+// size is 32*c^2 for an edge through the cell whatever its size: 2 takes edges of contrast 1/4 and up
+#define EDGE_STRENGTH 2.f
+// how much of the gradient has to point one way, 1 for a straight edge, 0 for noise or a corner
+#define EDGE_COHERENCE 0.5f
+
+void edge_glyphs(const float* edge_sums, int width, int x_len, int sample_size, int count_y, char* line) {
+    const float* xx_sums = edge_sums;
+    const float* xy_sums = edge_sums + x_len;
+    const float* upper = edge_sums + 2*(size_t)x_len;
+    const float* lower = edge_sums + 3*(size_t)x_len;
+    for(int i=0;i<x_len;i++) {
+        int count_x = sample_size < width - i*sample_size ? sample_size : width - i*sample_size;
+        float xx = xx_sums[i];
+        float yy = upper[i] + lower[i];
+        float xy = xy_sums[i];
+        float energy = xx + yy;
+        if(energy * sample_size < EDGE_STRENGTH * count_x * count_y) {
+            continue;
+        }
+        // the structure tensor's orientation at double angle, so both sides of a line agree instead of cancelling
+        float c = xx - yy;
+        float s = 2.f * xy;
+        if(c*c + s*s < EDGE_COHERENCE*EDGE_COHERENCE * energy*energy) {
+            continue;
+        }
+        if((c < 0 ? -c : c) >= (s < 0 ? -s : s)) {
+            if(c > 0) {
+                line[i] = '|'; // the gradient runs across, so the edge runs down
+            }else {
+                line[i] = lower[i] > 2.f * upper[i] ? '_' : '-';
+            }
+        }else {
+            line[i] = s > 0 ? '/' : '\\'; // y grows downwards: gx and gy of one sign make an edge rising to the right
+        }
+    }
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+// Edge glyphs from the gradient sums of one band: edge_sums holds four rows of x_len block sums, gx*gx, gx*gy and
+// gy*gy of the upper and of the lower half of the band's rows (see gradient_band).
+// Cells with a strong gradient that clearly runs one way get | / - or \ in place of their ramp glyph, and _ for a
+// horizontal edge in the lower half of the cell.
+void edge_glyphs(const float* edge_sums, int width, int x_len, int sample_size, int count_y, char* line);
@@ -0,0 +1,33 @@
+#include "string.h"
+
+#include <threads.h>
+
+#include "raster_glyphs.h"
+
+static const char default_ramp[] = " `.-':_,^=;><+!rc*/z?sLTv)J7(|Fi{C}fI31tlu[neoZ5Yxjya]2ESwqkP6h9d4VpOGbUAKXHm8RD#$Bg0MNWQ%&@";
+
+int build_glyphs(raster_glyphs* glyphs, const char* ramp, size_t length) {
+    if(length < 1 || length > RASTER_GLYPH_LEVELS) {
+        return -1;
+    }
+    int per_glyph = RASTER_GLYPH_LEVELS / (int)length;
+    glyphs->levels = per_glyph * (int)length;
+    glyphs->length = (int)length;
+    glyphs->scale = (float)glyphs->levels;
+    for(size_t g=0;g<length;g++) {
+        memset(glyphs->table + g*per_glyph, ramp[g], per_glyph);
+    }
+    return 0;
+}
+
+static once_flag default_once = ONCE_FLAG_INIT;
+static raster_glyphs default_glyphs;
+
+static void build_default_glyphs(void) {
+    build_glyphs(&default_glyphs, default_ramp, sizeof(default_ramp) - 1);
+}
+
+const raster_glyphs* get_default_glyphs(void) {
+    call_once(&default_once, build_default_glyphs);
+    return &default_glyphs;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "stddef.h"
+
+// brightness is quantized to at most this many levels before the table lookup
+#define RASTER_GLYPH_LEVELS 65536
+
+// A ramp compiled into a lookup table, so mapping a cell to its character is one multiply and one load
+// whatever the ramp. levels is the largest multiple of the ramp length that fits, every glyph owns
+// exactly levels/length consecutive entries, so the float path matches indexing the ramp with
+// brightness*length directly except at float rounding boundaries, where brightness*levels and
+// brightness*length land on different sides of a step (14 floats in [0, 1) for the built-in ramp).
+typedef struct {
+    int levels;
+    int length; // of the ramp, the glyph of step p is table[p * (levels/length)]
+    float scale; // levels as a float, brightness in [0, 1] times this is the table index
+    char table[RASTER_GLYPH_LEVELS];
+} raster_glyphs;
+
+// ramp runs from darkest to brightest, 1 to RASTER_GLYPH_LEVELS characters
+int build_glyphs(raster_glyphs* glyphs, const char* ramp, size_t length);
+
+// the built-in ramp, built on first use
+const raster_glyphs* get_default_glyphs(void);
+
+static inline char glyph_for(const raster_glyphs* glyphs, float brightness) {
+    int index = (int)(brightness * glyphs->scale);
+    return glyphs->table[index < glyphs->levels ? index : glyphs->levels - 1];
+}
+
+// fixed-point averages: a cell of 8-bit values adds up to at most max_sum = 255*count, its glyph is
+// (sum * reciprocal) >> 32 so the divide happens once per cell size instead of once per cell
+static inline unsigned long long glyph_reciprocal(const raster_glyphs* glyphs, unsigned int max_sum) {
+    return ((unsigned long long)glyphs->levels << 32) / max_sum + 1;
+}
+
+static inline char glyph_for_sum(const raster_glyphs* glyphs, unsigned int sum, unsigned long long reciprocal) {
+    unsigned int index = (unsigned int)((sum * reciprocal) >> 32);
+    return glyphs->table[index < (unsigned int)glyphs->levels ? index : (unsigned int)glyphs->levels - 1];
+}
@@ -0,0 +1,84 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "stdint.h"
+
+#include "raster_map.h"
+
+#ifdef _WIN32
+
+int map_file(const char* path, raster_map* map) {
+    // the sequential scan flag makes the cache manager read ahead further and recycle pages behind us
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(file == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    LARGE_INTEGER size;
+    if(GetFileType(file) != FILE_TYPE_DISK || !GetFileSizeEx(file, &size) || size.QuadPart <= 0 || (unsigned long long)size.QuadPart > SIZE_MAX) {
+        CloseHandle(file);
+        return -1;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file); // the mapping keeps the file open
+    if(mapping == NULL) {
+        return -1;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping); // and the view keeps the mapping
+    if(view == NULL) {
+        return -1;
+    }
+    map->data = view;
+    map->size = (size_t)size.QuadPart;
+    return 0;
+}
+
+void unmap_file(raster_map* map) {
+    if(map->data != NULL) {
+        UnmapViewOfFile(map->data);
+    }
+    map->data = NULL;
+    map->size = 0;
+}
+
+#else
+
+int map_file(const char* path, raster_map* map) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return -1;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0 || (unsigned long long)info.st_size > SIZE_MAX) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)info.st_size;
+    void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if(data == MAP_FAILED) {
+        return -1;
+    }
+    posix_madvise(data, size, POSIX_MADV_SEQUENTIAL); // only a hint, failing it changes nothing
+    map->data = data;
+    map->size = size;
+    return 0;
+}
+
+void unmap_file(raster_map* map) {
+    if(map->data != NULL) {
+        munmap((void*)map->data, map->size);
+    }
+    map->data = NULL;
+    map->size = 0;
+}
+
+#endif
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "stddef.h"
+
+// A whole file mapped read-only, so the decoder reads straight out of the page cache instead of through
+// stdio buffers. The kernel is told the pages will be read front to back, so it reads ahead and can drop
+// pages behind the decoder; repeated conversions of a hot file never copy it or touch the disk.
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+} raster_map;
+
+// returns 0 on success; -1 if the file can't be opened, is empty or is not a regular file (pipes, terminals),
+// callers then fall back to reading it with stdio
+int map_file(const char* path, raster_map* map);
+void unmap_file(raster_map* map);
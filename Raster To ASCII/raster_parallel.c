@@ -0,0 +1,181 @@
+#include "stdlib.h"
+
+#include <stdatomic.h>
+#include <threads.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "raster_parallel.h"
+
+// thread counts up to this run without any allocation
+#define RASTER_LOCAL_THREADS 64
+
+typedef struct {
+    raster_task task;
+    void* arg;
+    int begin;
+    int end;
+} raster_task_range;
+
+int raster_hardware_threads(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+#endif
+}
+
+int resolve_threads(int threads) {
+    return threads < 1 ? raster_hardware_threads() : threads;
+}
+
+static int raster_task_thread(void* arg) {
+    raster_task_range* range = arg;
+    range->task(range->arg, range->begin, range->end);
+    return 0;
+}
+
+void run_parallel(raster_task task, void* arg, int count, int threads) {
+    if(threads > count) {
+        threads = count;
+    }
+    if(threads <= 1) {
+        task(arg, 0, count);
+        return;
+    }
+    // called several times per frame, keep the common thread counts off the heap
+    thrd_t local_handles[RASTER_LOCAL_THREADS];
+    char local_started[RASTER_LOCAL_THREADS] = {0};
+    raster_task_range local_ranges[RASTER_LOCAL_THREADS];
+    int local = threads <= RASTER_LOCAL_THREADS;
+    thrd_t* handles = local ? local_handles : malloc(sizeof(thrd_t) * threads);
+    char* started = local ? local_started : calloc(threads, sizeof(char));
+    raster_task_range* ranges = local ? local_ranges : malloc(sizeof(raster_task_range) * threads);
+    for(int t=0;t<threads;t++) {
+        ranges[t].task = task;
+        ranges[t].arg = arg;
+        ranges[t].begin = (int)((long long)count * t / threads);
+        ranges[t].end = (int)((long long)count * (t+1) / threads);
+    }
+    for(int t=1;t<threads;t++) {
+        started[t] = thrd_create(&handles[t], raster_task_thread, &ranges[t]) == thrd_success;
+    }
+    raster_task_thread(&ranges[0]);
+    for(int t=1;t<threads;t++) {
+        if(started[t]) {
+            thrd_join(handles[t], NULL);
+        }else {
+            raster_task_thread(&ranges[t]); // could not spawn, do it here
+        }
+    }
+    if(!local) {
+        free(ranges);
+        free(started);
+        free(handles);
+    }
+}
+
+// polls of a row's progress before a waiting thread yields, and yields before it goes to sleep
+#define WAVEFRONT_SPINS 64
+#define WAVEFRONT_YIELDS 16
+
+// one row's published progress, a cache line each so publishing doesn't evict the lines other rows poll
+typedef struct {
+    atomic_int count;
+    char pad[64 - sizeof(atomic_int)];
+} wavefront_progress;
+
+struct raster_wavefront {
+    raster_row_task task;
+    void* arg;
+    int rows;
+    atomic_int next_row; // the next row to claim, rows go out in order so every row's predecessors are running
+    wavefront_progress* progress;
+    int sequential;
+    atomic_int sleepers; // waiters on advanced, publishing only takes the lock while there are any
+    mtx_t lock;
+    cnd_t advanced;
+};
+
+// threads claim rows instead of owning fixed ones, so a thread that couldn't be spawned and runs last
+// only finds nothing left instead of leaving rows that others wait on
+static void wavefront_worker(void* arg, int begin, int end) {
+    (void)begin; // one call per thread, the rows come from next_row
+    (void)end;
+    raster_wavefront* wave = arg;
+    for(;;) {
+        int row = atomic_fetch_add(&wave->next_row, 1);
+        if(row >= wave->rows) {
+            return;
+        }
+        wave->task(wave->arg, wave, row);
+    }
+}
+
+void run_wavefront(raster_row_task task, void* arg, int rows, int threads, raster_arena* arena) {
+    if(threads > rows) {
+        threads = rows;
+    }
+    raster_wavefront wave = {task, arg, rows};
+    if(threads <= 1) {
+        wave.sequential = 1; // every row above is already done
+        for(int row=0;row<rows;row++) {
+            task(arg, &wave, row);
+        }
+        return;
+    }
+    wave.progress = arena_alloc(arena, sizeof(wavefront_progress) * rows);
+    for(int row=0;row<rows;row++) {
+        atomic_init(&wave.progress[row].count, 0);
+    }
+    mtx_init(&wave.lock, mtx_plain);
+    cnd_init(&wave.advanced);
+    run_parallel(wavefront_worker, &wave, threads, threads);
+    cnd_destroy(&wave.advanced);
+    mtx_destroy(&wave.lock);
+    arena_free(arena, wave.progress);
+}
+
+// the row above is usually only a few cells ahead, so spin on its progress first and only sleep when its
+// thread isn't running; sleepers is raised before progress is read again under the lock and publish reads it
+// after its store (both sequentially consistent), so one of the two always sees the other
+void wavefront_wait(raster_wavefront* wave, int row, int count) {
+    if(wave->sequential || row < 0) {
+        return;
+    }
+    for(int spin=0;spin<WAVEFRONT_SPINS+WAVEFRONT_YIELDS;spin++) {
+        if(atomic_load_explicit(&wave->progress[row].count, memory_order_acquire) >= count) {
+            return;
+        }
+        if(spin >= WAVEFRONT_SPINS) {
+            thrd_yield();
+        }
+    }
+    mtx_lock(&wave->lock);
+    atomic_fetch_add(&wave->sleepers, 1);
+    while(atomic_load(&wave->progress[row].count) < count) {
+        cnd_wait(&wave->advanced, &wave->lock);
+    }
+    atomic_fetch_sub(&wave->sleepers, 1);
+    mtx_unlock(&wave->lock);
+}
+
+void wavefront_publish(raster_wavefront* wave, int row, int count) {
+    if(wave->sequential) {
+        return;
+    }
+    atomic_store(&wave->progress[row].count, count);
+    if(atomic_load(&wave->sleepers) > 0) {
+        mtx_lock(&wave->lock);
+        cnd_broadcast(&wave->advanced);
+        mtx_unlock(&wave->lock);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "raster_arena.h"
+
+// processes rows (or columns) [begin, end) of whatever arg describes
+typedef void (*raster_task)(void* arg, int begin, int end);
+
+int raster_hardware_threads(void);
+
+// threads < 1 means one per hardware thread
+int resolve_threads(int threads);
+
+// splits [0, count) into one contiguous range per thread and waits for all of them,
+// the calling thread works on the first range itself
+void run_parallel(raster_task task, void* arg, int count, int threads);
+
+// Rows that depend on the rows above them as they go (error diffusion): threads claim rows in order and a row
+// waits for the progress the row above has published before it reads what that row wrote into it
+typedef struct raster_wavefront raster_wavefront;
+typedef void (*raster_row_task)(void* arg, raster_wavefront* wave, int row);
+
+// the per-row progress counters come from arena (NULL means the heap)
+void run_wavefront(raster_row_task task, void* arg, int rows, int threads, raster_arena* arena);
+
+// blocks until row has published count (row -1 never blocks)
+void wavefront_wait(raster_wavefront* wave, int row, int count);
+// row is done with its first count items, everything it wrote before becomes visible to the rows waiting for them
+void wavefront_publish(raster_wavefront* wave, int row, int count);
@@ -0,0 +1,572 @@
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include "limits.h"
+#include "signal.h"
+#include "time.h"
+
+#include <threads.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+#endif
+#endif
+
+#include "raster_sequence.h"
+#include "raster_batch.h"
+#include "raster_map.h"
+#include "raster_stats.h"
+
+// Equal cells between two changed runs of a row are rewritten rather than skipped when they are this few:
+// skipping them takes a cursor move of at least 4 bytes ("\x1b[nC")
+#define SEQUENCE_MERGE_GAP 4
+
+enum { FRAME_END = 0, FRAME_OK = 1, FRAME_FAILED = -1 };
+
+typedef enum { SOURCE_FILES, SOURCE_PATTERN, SOURCE_RAW, SOURCE_Y4M } source_kind;
+
+typedef struct {
+    source_kind kind;
+    // files and numbered files
+    batch_paths files;
+    int next_file;
+    const char* pattern;
+    int number;
+    int probe; // the first number was not given, 1 is tried if there is no frame 0
+    char* name;
+    size_t name_capacity;
+    unsigned char* input; // only for files that can't be mapped
+    size_t input_capacity;
+    // frames on stdin
+    int width;
+    int height;
+    int channels;
+    size_t frame_bytes;     // everything one frame takes on stdin, Y4M chroma included
+    unsigned char* pixels;
+    int limited_range;      // Y4M luma in 16..235, stretched to 0..255 through full_range
+    unsigned char full_range[256];
+    int done;
+} frame_source;
+
+typedef struct {
+    char* data;
+    size_t size;
+    size_t capacity;
+} sequence_buffer;
+
+static volatile sig_atomic_t interrupted;
+
+static void on_interrupt(int signal_number) {
+    (void)signal_number;
+    interrupted = 1;
+}
+
+static void buffer_append(sequence_buffer* buffer, const char* data, size_t size) {
+    if(buffer->size + size > buffer->capacity) {
+        buffer->capacity = buffer->capacity * 2 > buffer->size + size ? buffer->capacity * 2 : buffer->size + size;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+// row and col from 0, ANSI counts from 1
+static void buffer_move_to(sequence_buffer* buffer, int row, int col) {
+    char move[32];
+    int size = snprintf(move, sizeof(move), "\x1b[%d;%dH", row + 1, col + 1);
+    buffer_append(buffer, move, size);
+}
+
+static void buffer_move_right(sequence_buffer* buffer, int cols) {
+    char move[32];
+    int size = snprintf(move, sizeof(move), "\x1b[%dC", cols);
+    buffer_append(buffer, move, size);
+}
+
+// Appends what turns previous into frame on screen, every cell when full. Rows are cols characters and a '\n'
+// in both; a row is skipped after a single memcmp unless something in it changed.
+static void append_delta(sequence_buffer* buffer, const char* previous, const char* frame, int rows, int cols, int full) {
+    for(int y=0;y<rows;y++) {
+        const char* before = full ? NULL : previous + (size_t)y * (cols + 1);
+        const char* after = frame + (size_t)y * (cols + 1);
+        if(before != NULL && memcmp(before, after, cols) == 0) {
+            continue;
+        }
+        int cursor = -1; // column the cursor is in after the last run of this row
+        int x = 0;
+        while(x < cols) {
+            if(before != NULL && before[x] == after[x]) {
+                x++;
+                continue;
+            }
+            int end = x + 1;
+            for(;;) {
+                while(end < cols && (before == NULL || before[end] != after[end])) {
+                    end++;
+                }
+                int next = end;
+                while(next < cols && before[next] == after[next]) {
+                    next++;
+                }
+                if(next == cols || next - end > SEQUENCE_MERGE_GAP) {
+                    break;
+                }
+                end = next;
+            }
+            if(cursor < 0) {
+                buffer_move_to(buffer, y, x);
+            }else {
+                buffer_move_right(buffer, x - cursor);
+            }
+            buffer_append(buffer, after + x, end - x);
+            cursor = x = end;
+        }
+    }
+}
+
+// "%d" with an optional zero flag and width, and "%%"; anything else would read arguments that aren't there
+static int check_pattern(const char* pattern) {
+    int conversions = 0;
+    for(const char* c = pattern; *c; c++) {
+        if(*c != '%') {
+            continue;
+        }
+        c++;
+        if(*c == '%') {
+            continue;
+        }
+        while(*c >= '0' && *c <= '9') {
+            c++;
+        }
+        if(*c != 'd') {
+            return -1;
+        }
+        conversions++;
+    }
+    return conversions == 1 ? 0 : -1;
+}
+
+// digit runs compare by value, so frame2 sorts before frame10
+static int compare_natural(const void* a, const void* b) {
+    const unsigned char* x = *(const unsigned char* const*)a;
+    const unsigned char* y = *(const unsigned char* const*)b;
+    while(*x && *y) {
+        if(*x >= '0' && *x <= '9' && *y >= '0' && *y <= '9') {
+            while(*x == '0') {
+                x++;
+            }
+            while(*y == '0') {
+                y++;
+            }
+            size_t x_digits = 0;
+            size_t y_digits = 0;
+            while(x[x_digits] >= '0' && x[x_digits] <= '9') {
+                x_digits++;
+            }
+            while(y[y_digits] >= '0' && y[y_digits] <= '9') {
+                y_digits++;
+            }
+            if(x_digits != y_digits) {
+                return x_digits < y_digits ? -1 : 1;
+            }
+            int order = memcmp(x, y, x_digits);
+            if(order != 0) {
+                return order;
+            }
+            x += x_digits;
+            y += y_digits;
+        }else if(*x != *y) {
+            return *x - *y;
+        }else {
+            x++;
+            y++;
+        }
+    }
+    return *x - *y;
+}
+
+// one line without its '\n', -1 at the end of the input or if it doesn't fit
+static int read_line(FILE* in, char* line, int capacity) {
+    int size = 0;
+    for(;;) {
+        int c = fgetc(in);
+        if(c == EOF) {
+            return -1;
+        }
+        if(c == '\n') {
+            line[size] = '\0';
+            return size;
+        }
+        if(size + 1 == capacity) {
+            return -1;
+        }
+        line[size++] = (char)c;
+    }
+}
+
+// bytes of the two chroma planes (and alpha) that follow the Y plane, -1 for colorspaces without 8-bit samples
+static long long y4m_extra_bytes(const char* colorspace, long long width, long long height) {
+    if(strcmp(colorspace, "420jpeg") == 0 || strcmp(colorspace, "420paldv") == 0 || strcmp(colorspace, "420mpeg2") == 0 ||
+       strcmp(colorspace, "420") == 0) {
+        return 2 * ((width + 1) / 2) * ((height + 1) / 2);
+    }
+    if(strcmp(colorspace, "422") == 0) {
+        return 2 * ((width + 1) / 2) * height;
+    }
+    if(strcmp(colorspace, "411") == 0) {
+        return 2 * ((width + 3) / 4) * height;
+    }
+    if(strcmp(colorspace, "444") == 0) {
+        return 2 * width * height;
+    }
+    if(strcmp(colorspace, "444alpha") == 0) {
+        return 3 * width * height;
+    }
+    if(strcmp(colorspace, "mono") == 0) {
+        return 0;
+    }
+    return -1;
+}
+
+// "YUV4MPEG2 W640 H480 F30:1 C420jpeg ...", only size, colorspace and color range matter here
+static int open_y4m(frame_source* src) {
+    char header[1024];
+    if(read_line(stdin, header, sizeof(header)) < 0 || strncmp(header, "YUV4MPEG2 ", 10) != 0) {
+        fprintf(stderr, "stdin is not YUV4MPEG2, raw pixels need --raw WIDTHxHEIGHT\n");
+        return -1;
+    }
+    long long width = 0;
+    long long height = 0;
+    char colorspace[32] = "420jpeg";
+    src->limited_range = 1;
+    for(char* token = header + 10; *token; ) {
+        char* end = strchr(token, ' ');
+        if(end != NULL) {
+            *end = '\0';
+        }
+        if(token[0] == 'W') {
+            width = strtoll(token + 1, NULL, 10);
+        }else if(token[0] == 'H') {
+            height = strtoll(token + 1, NULL, 10);
+        }else if(token[0] == 'C' && strlen(token + 1) < sizeof(colorspace)) {
+            strcpy(colorspace, token + 1);
+        }else if(strcmp(token, "XCOLORRANGE=FULL") == 0) {
+            src->limited_range = 0;
+        }
+        if(end == NULL) {
+            break;
+        }
+        token = end + 1;
+    }
+    if(width < 1 || height < 1 || width > INT_MAX || height > INT_MAX || width * height > INT_MAX) {
+        fprintf(stderr, "Bad YUV4MPEG2 frame size %lldx%lld\n", width, height);
+        return -1;
+    }
+    long long extra = y4m_extra_bytes(colorspace, width, height); // the checks above keep it from overflowing
+    if(extra < 0) {
+        fprintf(stderr, "Unsupported YUV4MPEG2 colorspace \"%s\", only 8-bit ones are read\n", colorspace);
+        return -1;
+    }
+    src->width = (int)width;
+    src->height = (int)height;
+    src->channels = 1;
+    src->frame_bytes = (size_t)(width * height + extra);
+    for(int v=0;v<256;v++) {
+        // video levels 16..235 to 0..255, rounded
+        src->full_range[v] = v <= 16 ? 0 : v >= 235 ? 255 : (unsigned char)(((v - 16) * 255 + 109) / 219);
+    }
+    return 0;
+}
+
+static int open_source(frame_source* src, char** inputs, int count, const sequence_config* config) {
+    memset(src, 0, sizeof(*src));
+    if(count == 1 && strcmp(inputs[0], "-") == 0) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        if(config->raw_width > 0) {
+            if(config->raw_height < 1 || config->raw_channels < 1 || config->raw_channels > 4 ||
+               (long long)config->raw_width * config->raw_height > INT_MAX) {
+                fprintf(stderr, "Raw frames need a size and 1 to 4 channels\n");
+                return -1;
+            }
+            src->kind = SOURCE_RAW;
+            src->width = config->raw_width;
+            src->height = config->raw_height;
+            src->channels = config->raw_channels;
+            src->frame_bytes = (size_t)src->width * src->height * src->channels;
+        }else {
+            src->kind = SOURCE_Y4M;
+            if(open_y4m(src) != 0) {
+                return -1;
+            }
+        }
+        src->pixels = malloc(src->frame_bytes);
+        return 0;
+    }
+    if(count == 1 && strchr(inputs[0], '%') != NULL) {
+        if(check_pattern(inputs[0]) != 0) {
+            fprintf(stderr, "\"%s\" needs exactly one %%d (zero padding and width allowed, %%%% for a %%)\n", inputs[0]);
+            return -1;
+        }
+        src->kind = SOURCE_PATTERN;
+        src->pattern = inputs[0];
+        src->number = config->start < 0 ? 0 : config->start;
+        src->probe = config->start < 0;
+        return 0;
+    }
+    src->kind = SOURCE_FILES;
+    for(int i=0;i<count;i++) {
+        int before = src->files.count;
+        batch_add_input(&src->files, inputs[i]);
+        qsort(src->files.items + before, src->files.count - before, sizeof(char*), compare_natural);
+    }
+    return 0;
+}
+
+static void close_source(frame_source* src) {
+    batch_free_paths(&src->files);
+    free(src->name);
+    free(src->input);
+    free(src->pixels);
+}
+
+static int read_file(frame_source* src, const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if(length <= 0) {
+        fclose(file);
+        return -1;
+    }
+    if(src->input_capacity < (size_t)length) {
+        free(src->input);
+        src->input = malloc(length);
+        src->input_capacity = length;
+    }
+    *size = fread(src->input, 1, length, file);
+    fclose(file);
+    return *size == (size_t)length ? 0 : -1;
+}
+
+// path of the current numbered frame in src->name
+static const char* pattern_name(frame_source* src) {
+    size_t size = (size_t)snprintf(NULL, 0, src->pattern, src->number) + 1;
+    if(src->name_capacity < size) {
+        free(src->name);
+        src->name = malloc(size);
+        src->name_capacity = size;
+    }
+    snprintf(src->name, size, src->pattern, src->number);
+    return src->name;
+}
+
+static int convert_file(frame_source* src, const char* path, raster_context* ctx, raster_options options,
+                        const char** frame, size_t* frame_size, int missing_ends) {
+    raster_map map = {NULL, 0};
+    const unsigned char* input;
+    size_t input_size;
+    if(map_file(path, &map) == 0) {
+        input = map.data;
+        input_size = map.size;
+    }else if(read_file(src, path, &input_size) == 0) {
+        input = src->input;
+    }else if(missing_ends) {
+        return FRAME_END;
+    }else {
+        fprintf(stderr, "Failed to read \"%s\"\n", path);
+        return FRAME_FAILED;
+    }
+    int status = raster_context_from_memory(ctx, input, input_size, options, frame, frame_size);
+    unmap_file(&map); // the frame lives in the context
+    if(status != RASTER_OK) {
+        fprintf(stderr, "Failed to convert \"%s\"\n", path);
+        return FRAME_FAILED;
+    }
+    return FRAME_OK;
+}
+
+// reads the next frame of stdin into src->pixels
+static int read_stdin_frame(frame_source* src) {
+    if(src->kind == SOURCE_Y4M) {
+        char header[256];
+        if(read_line(stdin, header, sizeof(header)) < 0) {
+            return FRAME_END;
+        }
+        if(strncmp(header, "FRAME", 5) != 0) {
+            fprintf(stderr, "Lost YUV4MPEG2 framing, expected a FRAME header\n");
+            return FRAME_END;
+        }
+    }
+    size_t got = fread(src->pixels, 1, src->frame_bytes, stdin);
+    if(got == 0 && src->kind == SOURCE_RAW) {
+        return FRAME_END;
+    }
+    if(got != src->frame_bytes) {
+        fprintf(stderr, "stdin ended in the middle of a frame\n");
+        src->done = 1;
+        return FRAME_FAILED;
+    }
+    if(src->kind == SOURCE_Y4M && src->limited_range) {
+        size_t luma_bytes = (size_t)src->width * src->height;
+        for(size_t i=0;i<luma_bytes;i++) {
+            src->pixels[i] = src->full_range[src->pixels[i]];
+        }
+    }
+    return FRAME_OK;
+}
+
+// FRAME_OK with *frame pointing into ctx, FRAME_FAILED for a frame that is skipped, FRAME_END after the last one
+static int next_frame(frame_source* src, raster_context* ctx, raster_options options, const char** frame, size_t* frame_size) {
+    if(src->done) {
+        return FRAME_END;
+    }
+    switch(src->kind) {
+    case SOURCE_FILES:
+        if(src->next_file == src->files.count) {
+            return FRAME_END;
+        }
+        return convert_file(src, src->files.items[src->next_file++], ctx, options, frame, frame_size, 0);
+    case SOURCE_PATTERN: {
+        int result = convert_file(src, pattern_name(src), ctx, options, frame, frame_size, 1);
+        if(result == FRAME_END && src->probe) {
+            src->number = 1;
+            result = convert_file(src, pattern_name(src), ctx, options, frame, frame_size, 1);
+        }
+        src->probe = 0;
+        src->number++;
+        return result;
+    }
+    default: {
+        int result = read_stdin_frame(src);
+        if(result != FRAME_OK) {
+            return result;
+        }
+        if(options.stats != NULL) {
+            options.stats->bytes_read += src->frame_bytes;
+        }
+        int status = raster_context_from_pixels(ctx, src->pixels, src->width, src->height, src->channels,
+                                                (size_t)src->width * src->channels, options, frame, frame_size);
+        if(status != RASTER_OK) {
+            fprintf(stderr, "Failed to convert a frame from stdin\n");
+            src->done = 1; // every frame has the same size and options, the next one would fail too
+            return FRAME_FAILED;
+        }
+        return FRAME_OK;
+    }
+    }
+}
+
+static void sleep_until(unsigned long long deadline) {
+    unsigned long long now = stats_now_ns();
+    if(now < deadline) {
+        struct timespec wait = {(time_t)((deadline - now) / 1000000000ull), (long)((deadline - now) % 1000000000ull)};
+        thrd_sleep(&wait, NULL);
+    }
+}
+
+static void write_buffer(sequence_buffer* buffer, FILE* out, raster_stats* stats) {
+    unsigned long long start = stats_now_ns();
+    fwrite(buffer->data, 1, buffer->size, out);
+    fflush(out);
+    if(stats != NULL) {
+        stats->output_ns += stats_now_ns() - start;
+    }
+    buffer->size = 0;
+}
+
+int run_sequence(char** inputs, int count, const sequence_config* config, raster_options options, FILE* out) {
+    frame_source src;
+    if(open_source(&src, inputs, count, config) != 0) {
+        close_source(&src);
+        return -1;
+    }
+#ifdef _WIN32
+    if(out == stdout) {
+        HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD mode;
+        if(GetConsoleMode(console, &mode)) {
+            SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+        }
+    }
+#endif
+    // two contexts take turns, so the previous frame stays valid while the next one is converted into the other
+    raster_context* contexts[2] = {raster_context_create(), raster_context_create()};
+    sequence_buffer buffer = {NULL, 0, 0};
+    const char* previous = NULL;
+    size_t previous_size = 0;
+    int previous_cols = 0;
+    int previous_rows = 0;
+    int frames = 0;
+    int failed = 0;
+    unsigned long long written = 0;
+    unsigned long long redraw = 0; // what writing every frame whole would have cost
+
+    interrupted = 0;
+    void (*previous_handler)(int) = signal(SIGINT, on_interrupt);
+    buffer_append(&buffer, "\x1b[?25l", 6); // no cursor flickering across the art
+    unsigned long long start = stats_now_ns();
+    while(!interrupted) {
+        const char* frame;
+        size_t frame_size;
+        int result = next_frame(&src, contexts[frames & 1], options, &frame, &frame_size);
+        if(result == FRAME_END) {
+            break;
+        }
+        if(result == FRAME_FAILED) {
+            failed++;
+            continue;
+        }
+        int cols = (int)((const char*)memchr(frame, '\n', frame_size) - frame);
+        int rows = (int)(frame_size / (cols + 1));
+        int full = previous == NULL || previous_size != frame_size || previous_cols != cols;
+        if(full) {
+            buffer_append(&buffer, "\x1b[2J", 4);
+        }
+        append_delta(&buffer, previous, frame, rows, cols, full);
+        if(config->fps > 0) {
+            sleep_until(start + (unsigned long long)(frames / config->fps * 1e9));
+        }
+        written += buffer.size;
+        redraw += frame_size;
+        write_buffer(&buffer, out, options.stats);
+        previous = frame;
+        previous_size = frame_size;
+        previous_cols = cols;
+        previous_rows = rows;
+        frames++;
+    }
+    double elapsed = (stats_now_ns() - start) * 1e-9;
+    if(src.kind == SOURCE_PATTERN && frames == 0 && failed == 0) {
+        fprintf(stderr, "No frame matches \"%s\"\n", src.pattern);
+        failed = 1;
+    }
+    if(previous != NULL) {
+        buffer_move_to(&buffer, previous_rows, 0); // the shell prompt goes below the art
+    }
+    buffer_append(&buffer, "\x1b[?25h", 6);
+    write_buffer(&buffer, out, options.stats);
+    signal(SIGINT, previous_handler == SIG_ERR ? SIG_DFL : previous_handler);
+
+    if(elapsed <= 0) {
+        elapsed = 1e-9;
+    }
+    fprintf(stderr, "Sequence: %d frames, %d failed, %.3f s, %.1f frames/s\n", frames, failed, elapsed, frames / elapsed);
+    fprintf(stderr, "Output: %llu bytes, %.1f%% of redrawing every frame, %.0f bytes per frame\n",
+            written, redraw > 0 ? 100.0 * written / redraw : 0.0, frames > 0 ? (double)written / frames : 0.0);
+
+    free(buffer.data);
+    raster_context_destroy(contexts[0]);
+    raster_context_destroy(contexts[1]);
+    close_source(&src);
+    return failed;
+}
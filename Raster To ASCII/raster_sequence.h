@@ -0,0 +1,25 @@
+#pragma once
+
+#include "stdio.h"
+
+#include "image_raster.h"
+
+typedef struct {
+    // frames on stdin are raw 8-bit pixels of this size when raw_width > 0, YUV4MPEG2 otherwise
+    int raw_width;
+    int raw_height;
+    int raw_channels;
+    int start;  // first number of a numbered sequence, < 0 tries 0 and then 1
+    double fps; // frames are shown no faster than this, 0 shows each one as soon as it is converted
+} sequence_config;
+
+// Converts a sequence of frames and writes them to out as ANSI terminal updates: the first frame, and every
+// frame whose size differs from the one before, clears the screen and is drawn whole; after that only the
+// runs of cells that changed are rewritten, each behind a cursor move, so the bytes written (and the
+// terminal's work) follow the motion in the scene instead of its size.
+// inputs is "-" for frames on stdin (see sequence_config; Y4M frames are converted from their Y plane, which
+// comes out like --gray), a single printf pattern with one %d such as "frame%04d.png" that is read up to the
+// first missing number, or any number of files and directories (a directory's images in natural order, so
+// frame2 comes before frame10). Prints a summary on stderr, returns the number of frames that failed or -1
+// if the inputs can't be read at all.
+int run_sequence(char** inputs, int count, const sequence_config* config, raster_options options, FILE* out);
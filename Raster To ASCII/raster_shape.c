@@ -0,0 +1,358 @@
+#include "limits.h"
+
+#include <threads.h>
+
+#include "raster_shape.h"
+
+// The printable ascii glyphs (' ' to '~') as 8x8 cells, one byte per row, low bit left. This is font8x8_basic
+// by Daniel Hepper, taken from Marcel Sondaar's font8x8 after the IBM PC BIOS font, both public domain.
+static const unsigned char shape_font[95][8] = {
+    {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00}, // ' '
+    {0x18,0x3c,0x3c,0x18,0x18,0x00,0x18,0x00}, // '!'
+    {0x36,0x36,0x00,0x00,0x00,0x00,0x00,0x00}, // '"'
+    {0x36,0x36,0x7f,0x36,0x7f,0x36,0x36,0x00}, // '#'
+    {0x0c,0x3e,0x03,0x1e,0x30,0x1f,0x0c,0x00}, // '$'
+    {0x00,0x63,0x33,0x18,0x0c,0x66,0x63,0x00}, // '%'
+    {0x1c,0x36,0x1c,0x6e,0x3b,0x33,0x6e,0x00}, // '&'
+    {0x06,0x06,0x03,0x00,0x00,0x00,0x00,0x00}, // '\''
+    {0x18,0x0c,0x06,0x06,0x06,0x0c,0x18,0x00}, // '('
+    {0x06,0x0c,0x18,0x18,0x18,0x0c,0x06,0x00}, // ')'
+    {0x00,0x66,0x3c,0xff,0x3c,0x66,0x00,0x00}, // '*'
+    {0x00,0x0c,0x0c,0x3f,0x0c,0x0c,0x00,0x00}, // '+'
+    {0x00,0x00,0x00,0x00,0x00,0x0c,0x0c,0x06}, // ','
+    {0x00,0x00,0x00,0x3f,0x00,0x00,0x00,0x00}, // '-'
+    {0x00,0x00,0x00,0x00,0x00,0x0c,0x0c,0x00}, // '.'
+    {0x60,0x30,0x18,0x0c,0x06,0x03,0x01,0x00}, // '/'
+    {0x3e,0x63,0x73,0x7b,0x6f,0x67,0x3e,0x00}, // '0'
+    {0x0c,0x0e,0x0c,0x0c,0x0c,0x0c,0x3f,0x00}, // '1'
+    {0x1e,0x33,0x30,0x1c,0x06,0x33,0x3f,0x00}, // '2'
+    {0x1e,0x33,0x30,0x1c,0x30,0x33,0x1e,0x00}, // '3'
+    {0x38,0x3c,0x36,0x33,0x7f,0x30,0x78,0x00}, // '4'
+    {0x3f,0x03,0x1f,0x30,0x30,0x33,0x1e,0x00}, // '5'
+    {0x1c,0x06,0x03,0x1f,0x33,0x33,0x1e,0x00}, // '6'
+    {0x3f,0x33,0x30,0x18,0x0c,0x0c,0x0c,0x00}, // '7'
+    {0x1e,0x33,0x33,0x1e,0x33,0x33,0x1e,0x00}, // '8'
+    {0x1e,0x33,0x33,0x3e,0x30,0x18,0x0e,0x00}, // '9'
+    {0x00,0x0c,0x0c,0x00,0x00,0x0c,0x0c,0x00}, // ':'
+    {0x00,0x0c,0x0c,0x00,0x00,0x0c,0x0c,0x06}, // ';'
+    {0x18,0x0c,0x06,0x03,0x06,0x0c,0x18,0x00}, // '<'
+    {0x00,0x00,0x3f,0x00,0x00,0x3f,0x00,0x00}, // '='
+    {0x06,0x0c,0x18,0x30,0x18,0x0c,0x06,0x00}, // '>'
+    {0x1e,0x33,0x30,0x18,0x0c,0x00,0x0c,0x00}, // '?'
+    {0x3e,0x63,0x7b,0x7b,0x7b,0x03,0x1e,0x00}, // '@'
+    {0x0c,0x1e,0x33,0x33,0x3f,0x33,0x33,0x00}, // 'A'
+    {0x3f,0x66,0x66,0x3e,0x66,0x66,0x3f,0x00}, // 'B'
+    {0x3c,0x66,0x03,0x03,0x03,0x66,0x3c,0x00}, // 'C'
+    {0x1f,0x36,0x66,0x66,0x66,0x36,0x1f,0x00}, // 'D'
+    {0x7f,0x46,0x16,0x1e,0x16,0x46,0x7f,0x00}, // 'E'
+    {0x7f,0x46,0x16,0x1e,0x16,0x06,0x0f,0x00}, // 'F'
+    {0x3c,0x66,0x03,0x03,0x73,0x66,0x7c,0x00}, // 'G'
+    {0x33,0x33,0x33,0x3f,0x33,0x33,0x33,0x00}, // 'H'
+    {0x1e,0x0c,0x0c,0x0c,0x0c,0x0c,0x1e,0x00}, // 'I'
+    {0x78,0x30,0x30,0x30,0x33,0x33,0x1e,0x00}, // 'J'
+    {0x67,0x66,0x36,0x1e,0x36,0x66,0x67,0x00}, // 'K'
+    {0x0f,0x06,0x06,0x06,0x46,0x66,0x7f,0x00}, // 'L'
+    {0x63,0x77,0x7f,0x7f,0x6b,0x63,0x63,0x00}, // 'M'
+    {0x63,0x67,0x6f,0x7b,0x73,0x63,0x63,0x00}, // 'N'
+    {0x1c,0x36,0x63,0x63,0x63,0x36,0x1c,0x00}, // 'O'
+    {0x3f,0x66,0x66,0x3e,0x06,0x06,0x0f,0x00}, // 'P'
+    {0x1e,0x33,0x33,0x33,0x3b,0x1e,0x38,0x00}, // 'Q'
+    {0x3f,0x66,0x66,0x3e,0x36,0x66,0x67,0x00}, // 'R'
+    {0x1e,0x33,0x07,0x0e,0x38,0x33,0x1e,0x00}, // 'S'
+    {0x3f,0x2d,0x0c,0x0c,0x0c,0x0c,0x1e,0x00}, // 'T'
+    {0x33,0x33,0x33,0x33,0x33,0x33,0x3f,0x00}, // 'U'
+    {0x33,0x33,0x33,0x33,0x33,0x1e,0x0c,0x00}, // 'V'
+    {0x63,0x63,0x63,0x6b,0x7f,0x77,0x63,0x00}, // 'W'
+    {0x63,0x63,0x36,0x1c,0x1c,0x36,0x63,0x00}, // 'X'
+    {0x33,0x33,0x33,0x1e,0x0c,0x0c,0x1e,0x00}, // 'Y'
+    {0x7f,0x63,0x31,0x18,0x4c,0x66,0x7f,0x00}, // 'Z'
+    {0x1e,0x06,0x06,0x06,0x06,0x06,0x1e,0x00}, // '['
+    {0x03,0x06,0x0c,0x18,0x30,0x60,0x40,0x00}, // '\\'
+    {0x1e,0x18,0x18,0x18,0x18,0x18,0x1e,0x00}, // ']'
+    {0x08,0x1c,0x36,0x63,0x00,0x00,0x00,0x00}, // '^'
+    {0x00,0x00,0x00,0x00,0x00,0x00,0x00,0xff}, // '_'
+    {0x0c,0x0c,0x18,0x00,0x00,0x00,0x00,0x00}, // '`'
+    {0x00,0x00,0x1e,0x30,0x3e,0x33,0x6e,0x00}, // 'a'
+    {0x07,0x06,0x06,0x3e,0x66,0x66,0x3b,0x00}, // 'b'
+    {0x00,0x00,0x1e,0x33,0x03,0x33,0x1e,0x00}, // 'c'
+    {0x38,0x30,0x30,0x3e,0x33,0x33,0x6e,0x00}, // 'd'
+    {0x00,0x00,0x1e,0x33,0x3f,0x03,0x1e,0x00}, // 'e'
+    {0x1c,0x36,0x06,0x0f,0x06,0x06,0x0f,0x00}, // 'f'
+    {0x00,0x00,0x6e,0x33,0x33,0x3e,0x30,0x1f}, // 'g'
+    {0x07,0x06,0x36,0x6e,0x66,0x66,0x67,0x00}, // 'h'
+    {0x0c,0x00,0x0e,0x0c,0x0c,0x0c,0x1e,0x00}, // 'i'
+    {0x30,0x00,0x30,0x30,0x30,0x33,0x33,0x1e}, // 'j'
+    {0x07,0x06,0x66,0x36,0x1e,0x36,0x67,0x00}, // 'k'
+    {0x0e,0x0c,0x0c,0x0c,0x0c,0x0c,0x1e,0x00}, // 'l'
+    {0x00,0x00,0x33,0x7f,0x7f,0x6b,0x63,0x00}, // 'm'
+    {0x00,0x00,0x1f,0x33,0x33,0x33,0x33,0x00}, // 'n'
+    {0x00,0x00,0x1e,0x33,0x33,0x33,0x1e,0x00}, // 'o'
+    {0x00,0x00,0x3b,0x66,0x66,0x3e,0x06,0x0f}, // 'p'
+    {0x00,0x00,0x6e,0x33,0x33,0x3e,0x30,0x78}, // 'q'
+    {0x00,0x00,0x3b,0x6e,0x66,0x06,0x0f,0x00}, // 'r'
+    {0x00,0x00,0x3e,0x03,0x1e,0x30,0x1f,0x00}, // 's'
+    {0x08,0x0c,0x3e,0x0c,0x0c,0x2c,0x18,0x00}, // 't'
+    {0x00,0x00,0x33,0x33,0x33,0x33,0x6e,0x00}, // 'u'
+    {0x00,0x00,0x33,0x33,0x33,0x1e,0x0c,0x00}, // 'v'
+    {0x00,0x00,0x63,0x6b,0x7f,0x7f,0x36,0x00}, // 'w'
+    {0x00,0x00,0x63,0x36,0x1c,0x36,0x63,0x00}, // 'x'
+    {0x00,0x00,0x33,0x33,0x33,0x3e,0x30,0x1f}, // 'y'
+    {0x00,0x00,0x3f,0x19,0x0c,0x26,0x3f,0x00}, // 'z'
+    {0x38,0x0c,0x0c,0x07,0x0c,0x0c,0x38,0x00}, // '{'
+    {0x18,0x18,0x18,0x00,0x18,0x18,0x18,0x00}, // '|'
+    {0x07,0x0c,0x0c,0x38,0x0c,0x0c,0x07,0x00}, // '}'
+    {0x6e,0x3b,0x00,0x00,0x00,0x00,0x00,0x00}, // '~'
+};
+
+_Static_assert(RASTER_SHAPE_GRID == 4, "the shape_cells kernels work on 4x4 sub-cells");
+
+// below this spread between the lightest and darkest sub-cell a cell is flat and keeps its brightness glyph
+#define SHAPE_CONTRAST 0.125f
+
+static once_flag masks_once = ONCE_FLAG_INIT;
+
+// By character, 0 for the ones the font doesn't have: the glyph's mask, then moved one sub-cell up, down, left and
+// right. A stroke that lands a sub-cell off the glyph's, like a line just below the middle against '-', still
+// matches it for the price of one bit.
+#define SHAPE_MOVES 5
+static unsigned short shape_masks[256][SHAPE_MOVES];
+static unsigned char shape_bits[256];   // set bits of every byte
+
+// the 8x8 glyph cut into 4x4 sub-cells of 2x2 pixels, a bit for every sub-cell with more ink than the glyph's mean
+static void build_shape_masks(void) {
+    for(int g=0;g<95;g++) {
+        int ink[RASTER_SHAPE_GRID*RASTER_SHAPE_GRID] = {0};
+        int total = 0;
+        for(int y=0;y<8;y++) {
+            for(int x=0;x<8;x++) {
+                if(shape_font[g][y] & (1 << x)) {
+                    ink[(y/2)*RASTER_SHAPE_GRID + x/2]++;
+                    total++;
+                }
+            }
+        }
+        unsigned short mask = 0;
+        for(int k=0;k<RASTER_SHAPE_GRID*RASTER_SHAPE_GRID;k++) {
+            if(ink[k]*RASTER_SHAPE_GRID*RASTER_SHAPE_GRID > total) {
+                mask |= 1 << k;
+            }
+        }
+        unsigned short* moves = shape_masks[' ' + g];
+        moves[0] = mask;
+        moves[1] = (unsigned short)(mask >> RASTER_SHAPE_GRID);
+        moves[2] = (unsigned short)(mask << RASTER_SHAPE_GRID);
+        moves[3] = (unsigned short)((mask >> 1) & 0x7777);
+        moves[4] = (unsigned short)((mask << 1) & 0xeeee);
+    }
+    for(int v=0;v<256;v++) {
+        shape_bits[v] = (unsigned char)((v & 1) + shape_bits[v >> 1]);
+    }
+}
+
+// what match_shape needs to know of the ramp, worked out once per line
+typedef struct {
+    const raster_glyphs* glyphs;
+    int per_glyph;                 // table entries of every ramp step
+    unsigned long long reciprocal; // (index * reciprocal) >> 32 = index / per_glyph for every table index
+    int window;                    // steps on either side of the brightness glyph that compete with it
+    int weight;                    // steps one bit of mask distance is worth
+} shape_ramp;
+
+static shape_ramp get_shape_ramp(const raster_glyphs* glyphs) {
+    shape_ramp ramp;
+    ramp.glyphs = glyphs;
+    ramp.per_glyph = glyphs->levels / glyphs->length;
+    ramp.reciprocal = ((1ull << 32) + ramp.per_glyph - 1) / ramp.per_glyph;
+    ramp.window = glyphs->length/4 + 1;
+    ramp.weight = (ramp.window + 2) / 3;
+    return ramp;
+}
+
+// bits that differ between a cell's mask and a glyph's, where moving the glyph a sub-cell costs one more
+static inline int shape_distance(unsigned int mask, const unsigned short* moves) {
+    int best = RASTER_SHAPE_GRID * RASTER_SHAPE_GRID;
+    for(int k=0;k<SHAPE_MOVES;k++) {
+        unsigned int v = mask ^ moves[k];
+        int distance = (k > 0) + shape_bits[v & 0xff] + shape_bits[v >> 8];
+        best = distance < best ? distance : best;
+    }
+    return best;
+}
+
+// The ramp glyphs within a quarter of the ramp of the brightness glyph compete on shape_distance * weight plus
+// the steps they are away, so one bit is worth about a twelfth of the ramp in brightness; ties go to the nearer
+// step, then to the darker one. User ramps are rarely ordered by how much ink a glyph really has ('-' sits 3
+// steps into the default one while a line through a cell covers a quarter of it), hence the wide window.
+static char match_shape(const shape_ramp* ramp, unsigned int mask, float mean) {
+    const raster_glyphs* glyphs = ramp->glyphs;
+    int index = (int)(mean * glyphs->scale);
+    index = index < glyphs->levels ? index : glyphs->levels - 1;
+    int position = (int)(((unsigned long long)index * ramp->reciprocal) >> 32);
+    char best = glyphs->table[index];
+    int best_cost = shape_distance(mask, shape_masks[(unsigned char)best]) * ramp->weight;
+    // outwards from the brightness glyph: a glyph step steps away costs at least step, so the search is over
+    // once step reaches the best cost
+    for(int step=1; step <= ramp->window && step < best_cost; step++) {
+        for(int side=-1; side <= 1; side += 2) {
+            int p = position + side*step;
+            if(p < 0 || p >= glyphs->length) {
+                continue;
+            }
+            char c = glyphs->table[p * ramp->per_glyph];
+            int cost = shape_distance(mask, shape_masks[(unsigned char)c]) * ramp->weight + step;
+            if(cost < best_cost) {
+                best_cost = cost;
+                best = c;
+            }
+        }
+    }
+    return best;
+}
+
+void shape_band_alloc(shape_band* band, raster_arena* arena, const raster_kernels* kernels, int width, int sample_size) {
+    band->kernels = kernels;
+    band->width = width;
+    band->sample_size = sample_size;
+    band->x_len = (width-1)/sample_size + 1;
+    band->cols = arena_alloc(arena, sizeof(float) * RASTER_SHAPE_GRID * width);
+    band->sums = arena_alloc(arena, sizeof(float) * RASTER_SHAPE_GRID * RASTER_SHAPE_GRID * band->x_len);
+    band->cells = arena_alloc(arena, sizeof(float) * RASTER_SHAPE_GRID * band->x_len);
+    band->means = arena_alloc(arena, sizeof(float) * band->x_len);
+    band->spreads = arena_alloc(arena, sizeof(float) * band->x_len);
+    band->masks = arena_alloc(arena, sizeof(unsigned short) * band->x_len);
+}
+
+void shape_band_free(shape_band* band, raster_arena* arena) {
+    arena_free(arena, band->masks);
+    arena_free(arena, band->spreads);
+    arena_free(arena, band->means);
+    arena_free(arena, band->cells);
+    arena_free(arena, band->sums);
+    arena_free(arena, band->cols);
+}
+
+// sub-cell sums of every sub-row: sub-cell s of a cell holds its columns s*sample_size/GRID up to
+// (s+1)*sample_size/GRID that are inside the image, 0 for none
+static void shape_block_sums(shape_band* band) {
+    int width = band->width, x_len = band->x_len, sample_size = band->sample_size;
+    int sub_x = RASTER_SHAPE_GRID * x_len;
+    if(sample_size % RASTER_SHAPE_GRID == 0) {
+        // whole cells are whole numbers of sub-cells, so every sub-row is one block_sum a quarter cell wide
+        int sub_size = sample_size / RASTER_SHAPE_GRID;
+        int blocks = (width + sub_size - 1) / sub_size;
+        for(int r=0;r<RASTER_SHAPE_GRID;r++) {
+            float* sums = band->sums + (size_t)r*sub_x;
+            band->kernels->block_sum(band->cols + (size_t)r*width, sums, width, sub_size);
+            for(int k=blocks;k<sub_x;k++) {
+                sums[k] = 0;
+            }
+        }
+        return;
+    }
+    int bounds[RASTER_SHAPE_GRID + 1];
+    for(int s=0;s<=RASTER_SHAPE_GRID;s++) {
+        bounds[s] = s*sample_size/RASTER_SHAPE_GRID;
+    }
+    // sub-cells are uneven, so each of the four is a block_sum_strided of its own width over every whole cell,
+    // gathered into band->cells (free until line_from_shape_sums adds the sub-rows up) and interleaved from there
+    int whole = width / sample_size;
+    float* split = band->cells;
+    for(int r=0;r<RASTER_SHAPE_GRID;r++) {
+        const float* cols = band->cols + (size_t)r*width;
+        float* sums = band->sums + (size_t)r*sub_x;
+        for(int s=0;s<RASTER_SHAPE_GRID;s++) {
+            band->kernels->block_sum_strided(cols + bounds[s], split + (size_t)s*x_len, whole, sample_size, bounds[s+1] - bounds[s]);
+        }
+        for(int i=0;i<whole;i++) {
+            for(int s=0;s<RASTER_SHAPE_GRID;s++) {
+                sums[i*RASTER_SHAPE_GRID + s] = split[(size_t)s*x_len + i];
+            }
+        }
+        for(int i=whole;i<x_len;i++) { // the last cell, cut short by the image edge
+            int x = i*sample_size;
+            for(int s=0;s<RASTER_SHAPE_GRID;s++) {
+                int begin = x + bounds[s] < width ? x + bounds[s] : width;
+                int end = x + bounds[s+1] < width ? x + bounds[s+1] : width;
+                float sum = 0;
+                for(int c=begin;c<end;c++) {
+                    sum += cols[c];
+                }
+                sums[i*RASTER_SHAPE_GRID + s] = sum;
+            }
+        }
+    }
+}
+
+// shape_cells for the last cell of a row when the image edge cuts it short, sub-cells past the edge take the
+// mean so they stay out of the mask
+static void shape_cut_cell(shape_band* band, int i, int count_x, const int* sub_width, const int* sub_height) {
+    size_t sub_x = (size_t)RASTER_SHAPE_GRID * band->x_len;
+    float mean = band->means[i];
+    unsigned int mask = 0;
+    float low = mean, high = mean;
+    for(int r=0;r<RASTER_SHAPE_GRID;r++) {
+        for(int s=0;s<RASTER_SHAPE_GRID;s++) {
+            int inside = count_x - s*band->sample_size/RASTER_SHAPE_GRID;
+            inside = inside < sub_width[s] ? inside : sub_width[s];
+            float average = inside > 0 ? band->sums[r*sub_x + (size_t)i*RASTER_SHAPE_GRID + s] / (inside * sub_height[r]) : mean;
+            mask |= (unsigned int)(average > mean) << (r*RASTER_SHAPE_GRID + s);
+            low = average < low ? average : low;
+            high = average > high ? average : high;
+        }
+    }
+    band->masks[i] = (unsigned short)mask;
+    band->spreads[i] = high - low;
+}
+
+void line_from_shape_sums(shape_band* band, const raster_glyphs* glyphs, int count_y, char* line) {
+    call_once(&masks_once, build_shape_masks);
+    int width = band->width, x_len = band->x_len, sample_size = band->sample_size;
+    size_t sub_x = (size_t)RASTER_SHAPE_GRID * x_len;
+    shape_block_sums(band);
+    // every sub-row's share of each cell, added up into the cell means
+    for(int r=0;r<RASTER_SHAPE_GRID;r++) {
+        band->kernels->block_sum(band->sums + r*sub_x, band->cells + (size_t)r*x_len, (int)sub_x, RASTER_SHAPE_GRID);
+    }
+    const float* cells = band->cells;
+    for(int i=0;i<x_len;i++) {
+        int count_x = sample_size < width - i*sample_size ? sample_size : width - i*sample_size;
+        float total = (cells[i] + cells[x_len + i]) + (cells[2*x_len + i] + cells[3*x_len + i]);
+        band->means[i] = total / (count_x * count_y);
+    }
+    if(count_y < RASTER_SHAPE_GRID) {
+        for(int i=0;i<x_len;i++) {
+            line[i] = glyph_for(glyphs, band->means[i]); // too short to have a shape
+        }
+        return;
+    }
+
+    int sub_width[RASTER_SHAPE_GRID];
+    int sub_height[RASTER_SHAPE_GRID] = {0};
+    for(int s=0;s<RASTER_SHAPE_GRID;s++) {
+        sub_width[s] = (s+1)*sample_size/RASTER_SHAPE_GRID - s*sample_size/RASTER_SHAPE_GRID;
+    }
+    for(int r=0;r<count_y;r++) {
+        sub_height[shape_sub_row(r, count_y)]++;
+    }
+    // whole cells turn sub-cell sums into averages with one multiply each
+    float reciprocal[RASTER_SHAPE_GRID*RASTER_SHAPE_GRID];
+    for(int k=0;k<RASTER_SHAPE_GRID*RASTER_SHAPE_GRID;k++) {
+        reciprocal[k] = 1.f / (sub_width[k % RASTER_SHAPE_GRID] * sub_height[k / RASTER_SHAPE_GRID]);
+    }
+    int whole = width / sample_size;
+    band->kernels->shape_cells(band->sums, sub_x, reciprocal, band->means, band->masks, band->spreads, whole);
+    int last_x = width - whole*sample_size;
+    if(whole < x_len && last_x >= RASTER_SHAPE_GRID) {
+        shape_cut_cell(band, whole, last_x, sub_width, sub_height);
+    }
+
+    shape_ramp ramp = get_shape_ramp(glyphs);
+    for(int i=0;i<x_len;i++) {
+        int count_x = i < whole ? sample_size : last_x;
+        if(count_x < RASTER_SHAPE_GRID || band->spreads[i] < SHAPE_CONTRAST) {
+            line[i] = glyph_for(glyphs, band->means[i]); // too narrow to have a shape, or flat
+        }else {
+            line[i] = match_shape(&ramp, band->masks[i], band->means[i]);
+        }
+    }
+}
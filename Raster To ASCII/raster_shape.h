@@ -0,0 +1,38 @@
+#pragma once
+
+#include "raster_arena.h"
+#include "raster_glyphs.h"
+#include "raster_simd.h"
+
+// shape matching splits every cell into this many sub-cells across and down
+#define RASTER_SHAPE_GRID 4
+
+// sub-row of row r of a band of count_y >= RASTER_SHAPE_GRID rows
+static inline int shape_sub_row(int r, int count_y) {
+    return r * RASTER_SHAPE_GRID / count_y;
+}
+
+// Sums of one band for shape matching, one per thread. Every row of the band is added to the column sums of its
+// shape_sub_row. At the end of the band each sub-row is cut into sub-cell sums, with one block_sum a quarter cell
+// wide when the sample size is a multiple of the grid and one block_sum_strided per sub-cell otherwise, and the
+// shape_cells kernel turns those into a 16-bit mask of the sub-cells above their cell's mean. The mask is matched
+// against the masks of the ramp glyphs near the brightness glyph by Hamming distance; flat cells and cells
+// narrower or shorter than the grid keep the brightness glyph.
+typedef struct {
+    const raster_kernels* kernels;
+    int width;
+    int sample_size;
+    int x_len;
+    float* cols;           // RASTER_SHAPE_GRID rows of width column sums, zero at the start of a band
+    float* sums;           // RASTER_SHAPE_GRID rows of RASTER_SHAPE_GRID*x_len sub-cell sums
+    float* cells;          // RASTER_SHAPE_GRID rows of x_len, each sub-row's share of the cell sums
+    float* means;          // x_len cell averages
+    float* spreads;        // x_len, lightest minus darkest sub-cell
+    unsigned short* masks; // x_len
+} shape_band;
+
+void shape_band_alloc(shape_band* band, raster_arena* arena, const raster_kernels* kernels, int width, int sample_size);
+void shape_band_free(shape_band* band, raster_arena* arena);
+
+// the band's x_len characters, count_y is the rows it holds
+void line_from_shape_sums(shape_band* band, const raster_glyphs* glyphs, int count_y, char* line);
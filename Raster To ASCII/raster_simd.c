@@ -0,0 +1,980 @@
+#include "string.h"
+
+#include <threads.h>
+
+#include "raster_simd.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RASTER_SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define RASTER_TARGET(isa)
+#else
+#include <cpuid.h>
+#define RASTER_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+
+// brightness = 1 - mean(color) * alpha, computed as (full - color_sum*alpha) * scale
+// so every channel layout reduces to one integer expression and one float multiply
+static inline int brightness_full(int channels) {
+    return (channels < 3 ? 1 : 3) * 255 * 255;
+}
+
+static void brightness_scalar(const unsigned char* src, float* dst, size_t count, int channels) {
+    const int full = brightness_full(channels);
+    const float scale = 1.f / (float)full;
+    switch(channels) {
+    case 1:
+        for(size_t i=0;i<count;i++) {
+            dst[i] = (float)(full - src[i]*255) * scale;
+        }
+        break;
+    case 2:
+        for(size_t i=0;i<count;i++) {
+            dst[i] = (float)(full - src[2*i]*src[2*i+1]) * scale;
+        }
+        break;
+    case 3:
+        for(size_t i=0;i<count;i++) {
+            dst[i] = (float)(full - (src[3*i] + src[3*i+1] + src[3*i+2])*255) * scale;
+        }
+        break;
+    case 4:
+        for(size_t i=0;i<count;i++) {
+            dst[i] = (float)(full - (src[4*i] + src[4*i+1] + src[4*i+2])*src[4*i+3]) * scale;
+        }
+        break;
+    }
+}
+
+// luma = round(brightness * 255) = (q * weight + 2^23) >> 24 with q = full - color_sum*alpha;
+// the weight is 255*2^24/full rounded, which keeps 255 at 255 and q*weight inside 32 bits
+static inline unsigned int luma_weight(int channels) {
+    unsigned int full = brightness_full(channels);
+    return (unsigned int)(((255ull << 24) + full/2) / full);
+}
+
+static inline unsigned char luma_from_sum(unsigned int full, unsigned int weight, unsigned int sum, unsigned int alpha) {
+    return (unsigned char)(((full - sum*alpha) * weight + (1u << 23)) >> 24);
+}
+
+static void luma_scalar(const unsigned char* src, unsigned char* dst, size_t count, int channels) {
+    const unsigned int full = brightness_full(channels);
+    const unsigned int weight = luma_weight(channels);
+    switch(channels) {
+    case 1:
+        for(size_t i=0;i<count;i++) {
+            dst[i] = luma_from_sum(full, weight, src[i], 255);
+        }
+        break;
+    case 2:
+        for(size_t i=0;i<count;i++) {
+            dst[i] = luma_from_sum(full, weight, src[2*i], src[2*i+1]);
+        }
+        break;
+    case 3:
+        for(size_t i=0;i<count;i++) {
+            dst[i] = luma_from_sum(full, weight, src[3*i] + src[3*i+1] + src[3*i+2], 255);
+        }
+        break;
+    case 4:
+        for(size_t i=0;i<count;i++) {
+            dst[i] = luma_from_sum(full, weight, src[4*i] + src[4*i+1] + src[4*i+2], src[4*i+3]);
+        }
+        break;
+    }
+}
+
+static void column_sum_scalar(const float* src, float* dst, int count) {
+    for(int i=0;i<count;i++) {
+        dst[i] += src[i];
+    }
+}
+
+static void block_sum_scalar(const float* cols, float* dst, int width, int sample_size) {
+    for(int x=0; x < width; x += sample_size) {
+        int count = width - x < sample_size ? width - x : sample_size;
+        float sum = 0;
+        for(int k=0;k<count;k++) {
+            sum += cols[x+k];
+        }
+        *dst++ = sum;
+    }
+}
+
+static void block_sum_strided_scalar(const float* cols, float* dst, int count, int stride, int size) {
+    for(int c=0;c<count;c++) {
+        const float* cell = cols + (size_t)c*stride;
+        float sum = 0;
+        for(int k=0;k<size;k++) {
+            sum += cell[k];
+        }
+        dst[c] = sum;
+    }
+}
+
+// columns begin..end of gradient_band, the vector versions use it for the edges and the tail
+static void gradient_band_columns(const float* const* rows, int count, float* sums, int width, int begin, int end) {
+    size_t stride = width;
+    int half = (count + 1) / 2;
+    for(int i=begin;i<end;i++) {
+        int l = i > 0 ? i - 1 : 0;
+        int h = i < width - 1 ? i + 1 : width - 1;
+        float sum = 0, xx = 0, xy = 0, yy[2] = {0, 0};
+        for(int r=0;r<count;r++) {
+            const float* above = rows[r];
+            const float* row = rows[r+1];
+            const float* below = rows[r+2];
+            float gx = (above[h] - above[l]) + 2.f*(row[h] - row[l]) + (below[h] - below[l]);
+            float gy = (below[l] - above[l]) + 2.f*(below[i] - above[i]) + (below[h] - above[h]);
+            sum += row[i];
+            xx += gx*gx;
+            xy += gx*gy;
+            yy[r >= half] += gy*gy;
+        }
+        sums[i] = sum;
+        sums[stride + i] = xx;
+        sums[2*stride + i] = xy;
+        sums[3*stride + i] = yy[0];
+        sums[4*stride + i] = yy[1];
+    }
+}
+
+static void gradient_band_scalar(const float* const* rows, int count, float* sums, int width) {
+    gradient_band_columns(rows, count, sums, width, 0, width);
+}
+
+static void shape_cells_scalar(const float* sums, size_t stride, const float* reciprocal, const float* means,
+                               unsigned short* masks, float* spreads, int count) {
+    for(int i=0;i<count;i++) {
+        unsigned int mask = 0;
+        float low = sums[4*i] * reciprocal[0], high = low;
+        for(int r=0;r<4;r++) {
+            for(int s=0;s<4;s++) {
+                float average = sums[r*stride + 4*i + s] * reciprocal[4*r + s];
+                mask |= (unsigned int)(average > means[i]) << (4*r + s);
+                low = average < low ? average : low;
+                high = average > high ? average : high;
+            }
+        }
+        masks[i] = (unsigned short)mask;
+        spreads[i] = high - low;
+    }
+}
+
+static void column_sum_u8_scalar(const unsigned char* src, unsigned short* dst, int count) {
+    for(int i=0;i<count;i++) {
+        dst[i] += src[i];
+    }
+}
+
+static void block_sum_u16_scalar(const unsigned short* cols, unsigned int* dst, int width, int sample_size, int stride) {
+    for(int x=0; x < width; x += sample_size) {
+        int count = width - x < sample_size ? width - x : sample_size;
+        unsigned int sum = 0;
+        for(int k=0;k<count;k++) {
+            sum += cols[(size_t)(x+k)*stride];
+        }
+        *dst++ = sum;
+    }
+}
+
+
+#ifdef RASTER_SIMD_X86
+
+// sse2: 4 pixels per step
+
+RASTER_TARGET("sse2")
+static inline __m128 brightness_from_sums_sse2(__m128i sum, __m128i alpha, __m128i full, __m128 scale) {
+    // sum and alpha fit in the low 16 bits of each lane, so madd is a 32-bit multiply
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(full, _mm_madd_epi16(sum, alpha))), scale);
+}
+
+RASTER_TARGET("sse2")
+static inline __m128i byte_sum3_sse2(__m128i px) {
+    const __m128i byte = _mm_set1_epi32(0xff);
+    return _mm_add_epi32(_mm_add_epi32(_mm_and_si128(px, byte), _mm_and_si128(_mm_srli_epi32(px, 8), byte)), _mm_and_si128(_mm_srli_epi32(px, 16), byte));
+}
+
+RASTER_TARGET("sse2")
+static void brightness_sse2(const unsigned char* src, float* dst, size_t count, int channels) {
+    const int full_value = brightness_full(channels);
+    const __m128i full = _mm_set1_epi32(full_value);
+    const __m128 scale = _mm_set1_ps(1.f / (float)full_value);
+    const __m128i opaque = _mm_set1_epi32(255);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    switch(channels) {
+    case 1:
+        for(; i + 4 <= count; i += 4) {
+            int v;
+            memcpy(&v, src + i, 4);
+            __m128i px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero), zero);
+            _mm_storeu_ps(dst + i, brightness_from_sums_sse2(px, opaque, full, scale));
+        }
+        break;
+    case 2:
+        for(; i + 4 <= count; i += 4) {
+            __m128i px = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(src + 2*i)), zero);
+            __m128i gray = _mm_and_si128(px, _mm_set1_epi32(0xff));
+            _mm_storeu_ps(dst + i, brightness_from_sums_sse2(gray, _mm_srli_epi32(px, 8), full, scale));
+        }
+        break;
+    case 3:
+        // each pixel is read as 4 bytes, so stop one pixel early to stay inside the buffer
+        for(; i + 4 < count; i += 4) {
+            int v[4];
+            for(int k=0;k<4;k++) {
+                memcpy(v + k, src + 3*(i+k), 4);
+            }
+            __m128i px = _mm_setr_epi32(v[0], v[1], v[2], v[3]);
+            _mm_storeu_ps(dst + i, brightness_from_sums_sse2(byte_sum3_sse2(px), opaque, full, scale));
+        }
+        break;
+    case 4:
+        for(; i + 4 <= count; i += 4) {
+            __m128i px = _mm_loadu_si128((const __m128i*)(src + 4*i));
+            _mm_storeu_ps(dst + i, brightness_from_sums_sse2(byte_sum3_sse2(px), _mm_srli_epi32(px, 24), full, scale));
+        }
+        break;
+    }
+    brightness_scalar(src + i*channels, dst + i, count - i, channels);
+}
+
+RASTER_TARGET("sse2")
+static void column_sum_sse2(const float* src, float* dst, int count) {
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+    }
+    column_sum_scalar(src + i, dst + i, count - i);
+}
+
+RASTER_TARGET("sse2")
+static void block_sum_strided_sse2(const float* cols, float* dst, int count, int stride, int size) {
+    int c = 0;
+    for(; c + 4 <= count; c += 4) {
+        const float* base = cols + (size_t)c*stride;
+        __m128 sum = _mm_setzero_ps();
+        for(int k=0;k<size;k++) {
+            sum = _mm_add_ps(sum, _mm_setr_ps(base[k], base[stride+k], base[2*stride+k], base[3*stride+k]));
+        }
+        _mm_storeu_ps(dst + c, sum);
+    }
+    block_sum_strided_scalar(cols + (size_t)c*stride, dst + c, count - c, stride, size);
+}
+
+RASTER_TARGET("sse2")
+static void block_sum_sse2(const float* cols, float* dst, int width, int sample_size) {
+    int full_cells = width / sample_size;
+    block_sum_strided_sse2(cols, dst, full_cells, sample_size, sample_size);
+    block_sum_scalar(cols + (size_t)full_cells*sample_size, dst + full_cells, width - full_cells*sample_size, sample_size);
+}
+
+// the same expressions as gradient_band_columns, 4 interior columns at a time down the whole band
+RASTER_TARGET("sse2")
+static void gradient_band_sse2(const float* const* rows, int count, float* sums, int width) {
+    size_t stride = width;
+    int half = (count + 1) / 2;
+    const __m128 two = _mm_set1_ps(2.f);
+    gradient_band_columns(rows, count, sums, width, 0, 1);
+    int i = 1;
+    for(; i + 5 <= width; i += 4) {
+        __m128 sum = _mm_setzero_ps(), xx = sum, xy = sum, yy_upper = sum, yy_lower = sum;
+        for(int r=0;r<count;r++) {
+            const float* above = rows[r] + i;
+            const float* row = rows[r+1] + i;
+            const float* below = rows[r+2] + i;
+            __m128 al = _mm_loadu_ps(above - 1), ac = _mm_loadu_ps(above), ah = _mm_loadu_ps(above + 1);
+            __m128 rl = _mm_loadu_ps(row - 1), rc = _mm_loadu_ps(row), rh = _mm_loadu_ps(row + 1);
+            __m128 bl = _mm_loadu_ps(below - 1), bc = _mm_loadu_ps(below), bh = _mm_loadu_ps(below + 1);
+            __m128 gx = _mm_add_ps(_mm_add_ps(_mm_sub_ps(ah, al), _mm_mul_ps(two, _mm_sub_ps(rh, rl))), _mm_sub_ps(bh, bl));
+            __m128 gy = _mm_add_ps(_mm_add_ps(_mm_sub_ps(bl, al), _mm_mul_ps(two, _mm_sub_ps(bc, ac))), _mm_sub_ps(bh, ah));
+            sum = _mm_add_ps(sum, rc);
+            xx = _mm_add_ps(xx, _mm_mul_ps(gx, gx));
+            xy = _mm_add_ps(xy, _mm_mul_ps(gx, gy));
+            if(r < half) {
+                yy_upper = _mm_add_ps(yy_upper, _mm_mul_ps(gy, gy));
+            }else {
+                yy_lower = _mm_add_ps(yy_lower, _mm_mul_ps(gy, gy));
+            }
+        }
+        _mm_storeu_ps(sums + i, sum);
+        _mm_storeu_ps(sums + stride + i, xx);
+        _mm_storeu_ps(sums + 2*stride + i, xy);
+        _mm_storeu_ps(sums + 3*stride + i, yy_upper);
+        _mm_storeu_ps(sums + 4*stride + i, yy_lower);
+    }
+    gradient_band_columns(rows, count, sums, width, i, width);
+}
+
+// a cell's sub-row of 4 averages per vector, the mask comes out of the compares whole
+RASTER_TARGET("sse2")
+static void shape_cells_sse2(const float* sums, size_t stride, const float* reciprocal, const float* means,
+                             unsigned short* masks, float* spreads, int count) {
+    __m128 scale[4];
+    for(int r=0;r<4;r++) {
+        scale[r] = _mm_loadu_ps(reciprocal + 4*r);
+    }
+    for(int i=0;i<count;i++) {
+        __m128 mean = _mm_set1_ps(means[i]);
+        __m128 low = _mm_mul_ps(_mm_loadu_ps(sums + 4*i), scale[0]), high = low;
+        int mask = _mm_movemask_ps(_mm_cmpgt_ps(low, mean));
+        for(int r=1;r<4;r++) {
+            __m128 average = _mm_mul_ps(_mm_loadu_ps(sums + r*stride + 4*i), scale[r]);
+            mask |= _mm_movemask_ps(_mm_cmpgt_ps(average, mean)) << 4*r;
+            low = _mm_min_ps(low, average);
+            high = _mm_max_ps(high, average);
+        }
+        low = _mm_min_ps(low, _mm_shuffle_ps(low, low, _MM_SHUFFLE(1, 0, 3, 2)));
+        low = _mm_min_ps(low, _mm_shuffle_ps(low, low, _MM_SHUFFLE(2, 3, 0, 1)));
+        high = _mm_max_ps(high, _mm_shuffle_ps(high, high, _MM_SHUFFLE(1, 0, 3, 2)));
+        high = _mm_max_ps(high, _mm_shuffle_ps(high, high, _MM_SHUFFLE(2, 3, 0, 1)));
+        masks[i] = (unsigned short)mask;
+        spreads[i] = _mm_cvtss_f32(_mm_sub_ps(high, low));
+    }
+}
+
+RASTER_TARGET("sse2")
+static inline int luma_from_sums_sse2(__m128i sum, __m128i alpha, __m128i full, __m128i weight) {
+    const __m128i round = _mm_set1_epi64x(1 << 23);
+    __m128i q = _mm_sub_epi32(full, _mm_madd_epi16(sum, alpha));
+    // no 32-bit multiply before sse4.1: even and odd lanes go through 32x32->64, the result fits the low dword
+    __m128i even = _mm_srli_epi64(_mm_add_epi64(_mm_mul_epu32(q, weight), round), 24);
+    __m128i odd = _mm_srli_epi64(_mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(q, 32), weight), round), 24);
+    __m128i luma = _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+    luma = _mm_packs_epi32(luma, luma);
+    return _mm_cvtsi128_si32(_mm_packus_epi16(luma, luma));
+}
+
+RASTER_TARGET("sse2")
+static void luma_sse2(const unsigned char* src, unsigned char* dst, size_t count, int channels) {
+    const __m128i full = _mm_set1_epi32(brightness_full(channels));
+    const __m128i weight = _mm_set1_epi32(luma_weight(channels));
+    const __m128i opaque = _mm_set1_epi32(255);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    int out;
+    switch(channels) {
+    case 1:
+        for(; i + 4 <= count; i += 4) {
+            int v;
+            memcpy(&v, src + i, 4);
+            __m128i px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero), zero);
+            out = luma_from_sums_sse2(px, opaque, full, weight);
+            memcpy(dst + i, &out, 4);
+        }
+        break;
+    case 2:
+        for(; i + 4 <= count; i += 4) {
+            __m128i px = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(src + 2*i)), zero);
+            __m128i gray = _mm_and_si128(px, _mm_set1_epi32(0xff));
+            out = luma_from_sums_sse2(gray, _mm_srli_epi32(px, 8), full, weight);
+            memcpy(dst + i, &out, 4);
+        }
+        break;
+    case 3:
+        for(; i + 4 < count; i += 4) {
+            int v[4];
+            for(int k=0;k<4;k++) {
+                memcpy(v + k, src + 3*(i+k), 4);
+            }
+            __m128i px = _mm_setr_epi32(v[0], v[1], v[2], v[3]);
+            out = luma_from_sums_sse2(byte_sum3_sse2(px), opaque, full, weight);
+            memcpy(dst + i, &out, 4);
+        }
+        break;
+    case 4:
+        for(; i + 4 <= count; i += 4) {
+            __m128i px = _mm_loadu_si128((const __m128i*)(src + 4*i));
+            out = luma_from_sums_sse2(byte_sum3_sse2(px), _mm_srli_epi32(px, 24), full, weight);
+            memcpy(dst + i, &out, 4);
+        }
+        break;
+    }
+    luma_scalar(src + i*channels, dst + i, count - i, channels);
+}
+
+// 16 columns per step, twice the float lanes
+RASTER_TARGET("sse2")
+static void column_sum_u8_sse2(const unsigned char* src, unsigned short* dst, int count) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for(; i + 16 <= count; i += 16) {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i* lo = (__m128i*)(dst + i);
+        __m128i* hi = (__m128i*)(dst + i + 8);
+        _mm_storeu_si128(lo, _mm_add_epi16(_mm_loadu_si128(lo), _mm_unpacklo_epi8(px, zero)));
+        _mm_storeu_si128(hi, _mm_add_epi16(_mm_loadu_si128(hi), _mm_unpackhi_epi8(px, zero)));
+    }
+    column_sum_u8_scalar(src + i, dst + i, count - i);
+}
+
+RASTER_TARGET("sse2")
+static void block_sum_u16_sse2(const unsigned short* cols, unsigned int* dst, int width, int sample_size, int stride) {
+    int full_cells = width / sample_size;
+    size_t cell = (size_t)sample_size * stride;
+    int c = 0;
+    for(; c + 4 <= full_cells; c += 4) {
+        const unsigned short* base = cols + c*cell;
+        __m128i sum = _mm_setzero_si128();
+        for(int k=0;k<sample_size;k++) {
+            const unsigned short* column = base + (size_t)k*stride;
+            sum = _mm_add_epi32(sum, _mm_setr_epi32(column[0], column[cell], column[2*cell], column[3*cell]));
+        }
+        _mm_storeu_si128((__m128i*)(dst + c), sum);
+    }
+    block_sum_u16_scalar(cols + c*cell, dst + c, width - c*sample_size, sample_size, stride);
+}
+
+
+// avx2: 8 pixels per step
+
+RASTER_TARGET("avx2")
+static inline __m256 brightness_from_sums_avx2(__m256i sum, __m256i alpha, __m256i full, __m256 scale) {
+    return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(full, _mm256_mullo_epi32(sum, alpha))), scale);
+}
+
+RASTER_TARGET("avx2")
+static inline __m256i byte_sum3_avx2(__m256i px) {
+    // bytes r,g,b,x weighted 1,1,1,0 into 16-bit pairs, then the pairs into 32 bits
+    return _mm256_madd_epi16(_mm256_maddubs_epi16(px, _mm256_set1_epi32(0x00010101)), _mm256_set1_epi16(1));
+}
+
+RASTER_TARGET("avx2")
+static void brightness_avx2(const unsigned char* src, float* dst, size_t count, int channels) {
+    const int full_value = brightness_full(channels);
+    const __m256i full = _mm256_set1_epi32(full_value);
+    const __m256 scale = _mm256_set1_ps(1.f / (float)full_value);
+    const __m256i opaque = _mm256_set1_epi32(255);
+    size_t i = 0;
+    switch(channels) {
+    case 1:
+        for(; i + 8 <= count; i += 8) {
+            __m256i px = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+            _mm256_storeu_ps(dst + i, brightness_from_sums_avx2(px, opaque, full, scale));
+        }
+        break;
+    case 2:
+        for(; i + 8 <= count; i += 8) {
+            __m256i px = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + 2*i)));
+            __m256i gray = _mm256_and_si256(px, _mm256_set1_epi32(0xff));
+            _mm256_storeu_ps(dst + i, brightness_from_sums_avx2(gray, _mm256_srli_epi32(px, 8), full, scale));
+        }
+        break;
+    case 3: {
+        // 24 bytes of pixels are loaded as 32, spread to 12 per 128-bit lane, then to one pixel per dword
+        const __m256i spread = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+        const __m256i unpack = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                                0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        for(; 3*(i + 8) + 8 <= 3*count; i += 8) {
+            __m256i px = _mm256_loadu_si256((const __m256i*)(src + 3*i));
+            px = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(px, spread), unpack);
+            _mm256_storeu_ps(dst + i, brightness_from_sums_avx2(byte_sum3_avx2(px), opaque, full, scale));
+        }
+        break;
+    }
+    case 4:
+        for(; i + 8 <= count; i += 8) {
+            __m256i px = _mm256_loadu_si256((const __m256i*)(src + 4*i));
+            _mm256_storeu_ps(dst + i, brightness_from_sums_avx2(byte_sum3_avx2(px), _mm256_srli_epi32(px, 24), full, scale));
+        }
+        break;
+    }
+    brightness_scalar(src + i*channels, dst + i, count - i, channels);
+}
+
+RASTER_TARGET("avx2")
+static void column_sum_avx2(const float* src, float* dst, int count) {
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+    }
+    column_sum_scalar(src + i, dst + i, count - i);
+}
+
+RASTER_TARGET("avx2")
+static void block_sum_strided_avx2(const float* cols, float* dst, int count, int stride, int size) {
+    const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+    int c = 0;
+    for(; c + 8 <= count; c += 8) {
+        const float* base = cols + (size_t)c*stride;
+        __m256 sum = _mm256_setzero_ps();
+        for(int k=0;k<size;k++) {
+            sum = _mm256_add_ps(sum, _mm256_i32gather_ps(base + k, index, 4));
+        }
+        _mm256_storeu_ps(dst + c, sum);
+    }
+    block_sum_strided_scalar(cols + (size_t)c*stride, dst + c, count - c, stride, size);
+}
+
+RASTER_TARGET("avx2")
+static void block_sum_avx2(const float* cols, float* dst, int width, int sample_size) {
+    int full_cells = width / sample_size;
+    block_sum_strided_avx2(cols, dst, full_cells, sample_size, sample_size);
+    block_sum_scalar(cols + (size_t)full_cells*sample_size, dst + full_cells, width - full_cells*sample_size, sample_size);
+}
+
+RASTER_TARGET("avx2")
+static void gradient_band_avx2(const float* const* rows, int count, float* sums, int width) {
+    size_t stride = width;
+    int half = (count + 1) / 2;
+    const __m256 two = _mm256_set1_ps(2.f);
+    gradient_band_columns(rows, count, sums, width, 0, 1);
+    int i = 1;
+    for(; i + 9 <= width; i += 8) {
+        __m256 sum = _mm256_setzero_ps(), xx = sum, xy = sum, yy_upper = sum, yy_lower = sum;
+        for(int r=0;r<count;r++) {
+            const float* above = rows[r] + i;
+            const float* row = rows[r+1] + i;
+            const float* below = rows[r+2] + i;
+            __m256 al = _mm256_loadu_ps(above - 1), ac = _mm256_loadu_ps(above), ah = _mm256_loadu_ps(above + 1);
+            __m256 rl = _mm256_loadu_ps(row - 1), rc = _mm256_loadu_ps(row), rh = _mm256_loadu_ps(row + 1);
+            __m256 bl = _mm256_loadu_ps(below - 1), bc = _mm256_loadu_ps(below), bh = _mm256_loadu_ps(below + 1);
+            __m256 gx = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(ah, al), _mm256_mul_ps(two, _mm256_sub_ps(rh, rl))), _mm256_sub_ps(bh, bl));
+            __m256 gy = _mm256_add_ps(_mm256_add_ps(_mm256_sub_ps(bl, al), _mm256_mul_ps(two, _mm256_sub_ps(bc, ac))), _mm256_sub_ps(bh, ah));
+            sum = _mm256_add_ps(sum, rc);
+            xx = _mm256_add_ps(xx, _mm256_mul_ps(gx, gx));
+            xy = _mm256_add_ps(xy, _mm256_mul_ps(gx, gy));
+            if(r < half) {
+                yy_upper = _mm256_add_ps(yy_upper, _mm256_mul_ps(gy, gy));
+            }else {
+                yy_lower = _mm256_add_ps(yy_lower, _mm256_mul_ps(gy, gy));
+            }
+        }
+        _mm256_storeu_ps(sums + i, sum);
+        _mm256_storeu_ps(sums + stride + i, xx);
+        _mm256_storeu_ps(sums + 2*stride + i, xy);
+        _mm256_storeu_ps(sums + 3*stride + i, yy_upper);
+        _mm256_storeu_ps(sums + 4*stride + i, yy_lower);
+    }
+    gradient_band_columns(rows, count, sums, width, i, width);
+}
+
+// two cells per vector, one in each 128-bit half
+RASTER_TARGET("avx2")
+static void shape_cells_avx2(const float* sums, size_t stride, const float* reciprocal, const float* means,
+                             unsigned short* masks, float* spreads, int count) {
+    __m256 scale[4];
+    for(int r=0;r<4;r++) {
+        scale[r] = _mm256_broadcast_ps((const __m128*)(reciprocal + 4*r));
+    }
+    int i = 0;
+    for(; i + 2 <= count; i += 2) {
+        __m256 mean = _mm256_setr_ps(means[i], means[i], means[i], means[i], means[i+1], means[i+1], means[i+1], means[i+1]);
+        __m256 low = _mm256_mul_ps(_mm256_loadu_ps(sums + 4*i), scale[0]), high = low;
+        int bits = _mm256_movemask_ps(_mm256_cmp_ps(low, mean, _CMP_GT_OQ));
+        int mask0 = bits & 15, mask1 = bits >> 4;
+        for(int r=1;r<4;r++) {
+            __m256 average = _mm256_mul_ps(_mm256_loadu_ps(sums + r*stride + 4*i), scale[r]);
+            bits = _mm256_movemask_ps(_mm256_cmp_ps(average, mean, _CMP_GT_OQ));
+            mask0 |= (bits & 15) << 4*r;
+            mask1 |= (bits >> 4) << 4*r;
+            low = _mm256_min_ps(low, average);
+            high = _mm256_max_ps(high, average);
+        }
+        low = _mm256_min_ps(low, _mm256_permute_ps(low, _MM_SHUFFLE(1, 0, 3, 2)));
+        low = _mm256_min_ps(low, _mm256_permute_ps(low, _MM_SHUFFLE(2, 3, 0, 1)));
+        high = _mm256_max_ps(high, _mm256_permute_ps(high, _MM_SHUFFLE(1, 0, 3, 2)));
+        high = _mm256_max_ps(high, _mm256_permute_ps(high, _MM_SHUFFLE(2, 3, 0, 1)));
+        __m256 spread = _mm256_sub_ps(high, low);
+        masks[i] = (unsigned short)mask0;
+        masks[i+1] = (unsigned short)mask1;
+        spreads[i] = _mm_cvtss_f32(_mm256_castps256_ps128(spread));
+        spreads[i+1] = _mm_cvtss_f32(_mm256_extractf128_ps(spread, 1));
+    }
+    shape_cells_scalar(sums + 4*i, stride, reciprocal, means + i, masks + i, spreads + i, count - i);
+}
+
+RASTER_TARGET("avx2")
+static inline void store_luma_avx2(unsigned char* dst, __m256i sum, __m256i alpha, __m256i full, __m256i weight) {
+    __m256i q = _mm256_sub_epi32(full, _mm256_mullo_epi32(sum, alpha));
+    __m256i luma = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(q, weight), _mm256_set1_epi32(1 << 23)), 24);
+    __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(luma), _mm256_extracti128_si256(luma, 1));
+    _mm_storel_epi64((__m128i*)dst, _mm_packus_epi16(words, words));
+}
+
+RASTER_TARGET("avx2")
+static void luma_avx2(const unsigned char* src, unsigned char* dst, size_t count, int channels) {
+    const __m256i full = _mm256_set1_epi32(brightness_full(channels));
+    const __m256i weight = _mm256_set1_epi32(luma_weight(channels));
+    const __m256i opaque = _mm256_set1_epi32(255);
+    size_t i = 0;
+    switch(channels) {
+    case 1:
+        for(; i + 8 <= count; i += 8) {
+            __m256i px = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+            store_luma_avx2(dst + i, px, opaque, full, weight);
+        }
+        break;
+    case 2:
+        for(; i + 8 <= count; i += 8) {
+            __m256i px = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + 2*i)));
+            __m256i gray = _mm256_and_si256(px, _mm256_set1_epi32(0xff));
+            store_luma_avx2(dst + i, gray, _mm256_srli_epi32(px, 8), full, weight);
+        }
+        break;
+    case 3: {
+        const __m256i spread = _mm256_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0);
+        const __m256i unpack = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                                0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        for(; 3*(i + 8) + 8 <= 3*count; i += 8) {
+            __m256i px = _mm256_loadu_si256((const __m256i*)(src + 3*i));
+            px = _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(px, spread), unpack);
+            store_luma_avx2(dst + i, byte_sum3_avx2(px), opaque, full, weight);
+        }
+        break;
+    }
+    case 4:
+        for(; i + 8 <= count; i += 8) {
+            __m256i px = _mm256_loadu_si256((const __m256i*)(src + 4*i));
+            store_luma_avx2(dst + i, byte_sum3_avx2(px), _mm256_srli_epi32(px, 24), full, weight);
+        }
+        break;
+    }
+    luma_scalar(src + i*channels, dst + i, count - i, channels);
+}
+
+RASTER_TARGET("avx2")
+static void column_sum_u8_avx2(const unsigned char* src, unsigned short* dst, int count) {
+    int i = 0;
+    for(; i + 16 <= count; i += 16) {
+        __m256i px = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + i)));
+        __m256i* acc = (__m256i*)(dst + i);
+        _mm256_storeu_si256(acc, _mm256_add_epi16(_mm256_loadu_si256(acc), px));
+    }
+    column_sum_u8_scalar(src + i, dst + i, count - i);
+}
+
+// gathers read 32 bits at each 16-bit column and keep the low half, hence the readable element past width
+RASTER_TARGET("avx2")
+static void block_sum_u16_avx2(const unsigned short* cols, unsigned int* dst, int width, int sample_size, int stride) {
+    const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(sample_size*stride));
+    const __m256i low = _mm256_set1_epi32(0xffff);
+    int full_cells = width / sample_size;
+    size_t cell = (size_t)sample_size * stride;
+    int c = 0;
+    for(; c + 8 <= full_cells; c += 8) {
+        const unsigned short* base = cols + c*cell;
+        __m256i sum = _mm256_setzero_si256();
+        for(int k=0;k<sample_size;k++) {
+            sum = _mm256_add_epi32(sum, _mm256_and_si256(_mm256_i32gather_epi32((const int*)(base + (size_t)k*stride), index, 2), low));
+        }
+        _mm256_storeu_si256((__m256i*)(dst + c), sum);
+    }
+    block_sum_u16_scalar(cols + c*cell, dst + c, width - c*sample_size, sample_size, stride);
+}
+
+
+// avx-512: 16 pixels per step
+
+RASTER_TARGET("avx512f,avx512bw")
+static inline __m512 brightness_from_sums_avx512(__m512i sum, __m512i alpha, __m512i full, __m512 scale) {
+    return _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_sub_epi32(full, _mm512_mullo_epi32(sum, alpha))), scale);
+}
+
+RASTER_TARGET("avx512f,avx512bw")
+static inline __m512i byte_sum3_avx512(__m512i px) {
+    return _mm512_madd_epi16(_mm512_maddubs_epi16(px, _mm512_set1_epi32(0x00010101)), _mm512_set1_epi16(1));
+}
+
+RASTER_TARGET("avx512f,avx512bw")
+static void brightness_avx512(const unsigned char* src, float* dst, size_t count, int channels) {
+    const int full_value = brightness_full(channels);
+    const __m512i full = _mm512_set1_epi32(full_value);
+    const __m512 scale = _mm512_set1_ps(1.f / (float)full_value);
+    const __m512i opaque = _mm512_set1_epi32(255);
+    size_t i = 0;
+    switch(channels) {
+    case 1:
+        for(; i + 16 <= count; i += 16) {
+            __m512i px = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+            _mm512_storeu_ps(dst + i, brightness_from_sums_avx512(px, opaque, full, scale));
+        }
+        break;
+    case 2:
+        for(; i + 16 <= count; i += 16) {
+            __m512i px = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(src + 2*i)));
+            __m512i gray = _mm512_and_si512(px, _mm512_set1_epi32(0xff));
+            _mm512_storeu_ps(dst + i, brightness_from_sums_avx512(gray, _mm512_srli_epi32(px, 8), full, scale));
+        }
+        break;
+    case 3: {
+        const __m512i spread = _mm512_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0, 6, 7, 8, 0, 9, 10, 11, 0);
+        const __m512i unpack = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+        for(; 3*(i + 16) + 16 <= 3*count; i += 16) {
+            __m512i px = _mm512_loadu_si512((const void*)(src + 3*i));
+            px = _mm512_shuffle_epi8(_mm512_permutexvar_epi32(spread, px), unpack);
+            _mm512_storeu_ps(dst + i, brightness_from_sums_avx512(byte_sum3_avx512(px), opaque, full, scale));
+        }
+        break;
+    }
+    case 4:
+        for(; i + 16 <= count; i += 16) {
+            __m512i px = _mm512_loadu_si512((const void*)(src + 4*i));
+            _mm512_storeu_ps(dst + i, brightness_from_sums_avx512(byte_sum3_avx512(px), _mm512_srli_epi32(px, 24), full, scale));
+        }
+        break;
+    }
+    brightness_scalar(src + i*channels, dst + i, count - i, channels);
+}
+
+RASTER_TARGET("avx512f,avx512bw")
+static void column_sum_avx512(const float* src, float* dst, int count) {
+    int i = 0;
+    for(; i + 16 <= count; i += 16) {
+        _mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_loadu_ps(dst + i), _mm512_loadu_ps(src + i)));
+    }
+    column_sum_scalar(src + i, dst + i, count - i);
+}
+
+RASTER_TARGET("avx512f,avx512bw")
+static void block_sum_strided_avx512(const float* cols, float* dst, int count, int stride, int size) {
+    const __m512i index = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(stride));
+    int c = 0;
+    for(; c + 16 <= count; c += 16) {
+        const float* base = cols + (size_t)c*stride;
+        __m512 sum = _mm512_setzero_ps();
+        for(int k=0;k<size;k++) {
+            sum = _mm512_add_ps(sum, _mm512_i32gather_ps(index, base + k, 4));
+        }
+        _mm512_storeu_ps(dst + c, sum);
+    }
+    block_sum_strided_scalar(cols + (size_t)c*stride, dst + c, count - c, stride, size);
+}
+
+RASTER_TARGET("avx512f,avx512bw")
+static void block_sum_avx512(const float* cols, float* dst, int width, int sample_size) {
+    int full_cells = width / sample_size;
+    block_sum_strided_avx512(cols, dst, full_cells, sample_size, sample_size);
+    block_sum_scalar(cols + (size_t)full_cells*sample_size, dst + full_cells, width - full_cells*sample_size, sample_size);
+}
+
+RASTER_TARGET("avx512f,avx512bw")
+static void gradient_band_avx512(const float* const* rows, int count, float* sums, int width) {
+    size_t stride = width;
+    int half = (count + 1) / 2;
+    const __m512 two = _mm512_set1_ps(2.f);
+    gradient_band_columns(rows, count, sums, width, 0, 1);
+    int i = 1;
+    for(; i + 17 <= width; i += 16) {
+        __m512 sum = _mm512_setzero_ps(), xx = sum, xy = sum, yy_upper = sum, yy_lower = sum;
+        for(int r=0;r<count;r++) {
+            const float* above = rows[r] + i;
+            const float* row = rows[r+1] + i;
+            const float* below = rows[r+2] + i;
+            __m512 al = _mm512_loadu_ps(above - 1), ac = _mm512_loadu_ps(above), ah = _mm512_loadu_ps(above + 1);
+            __m512 rl = _mm512_loadu_ps(row - 1), rc = _mm512_loadu_ps(row), rh = _mm512_loadu_ps(row + 1);
+            __m512 bl = _mm512_loadu_ps(below - 1), bc = _mm512_loadu_ps(below), bh = _mm512_loadu_ps(below + 1);
+            __m512 gx = _mm512_add_ps(_mm512_add_ps(_mm512_sub_ps(ah, al), _mm512_mul_ps(two, _mm512_sub_ps(rh, rl))), _mm512_sub_ps(bh, bl));
+            __m512 gy = _mm512_add_ps(_mm512_add_ps(_mm512_sub_ps(bl, al), _mm512_mul_ps(two, _mm512_sub_ps(bc, ac))), _mm512_sub_ps(bh, ah));
+            sum = _mm512_add_ps(sum, rc);
+            xx = _mm512_add_ps(xx, _mm512_mul_ps(gx, gx));
+            xy = _mm512_add_ps(xy, _mm512_mul_ps(gx, gy));
+            if(r < half) {
+                yy_upper = _mm512_add_ps(yy_upper, _mm512_mul_ps(gy, gy));
+            }else {
+                yy_lower = _mm512_add_ps(yy_lower, _mm512_mul_ps(gy, gy));
+            }
+        }
+        _mm512_storeu_ps(sums + i, sum);
+        _mm512_storeu_ps(sums + stride + i, xx);
+        _mm512_storeu_ps(sums + 2*stride + i, xy);
+        _mm512_storeu_ps(sums + 3*stride + i, yy_upper);
+        _mm512_storeu_ps(sums + 4*stride + i, yy_lower);
+    }
+    gradient_band_columns(rows, count, sums, width, i, width);
+}
+
+// four cells per vector, one in each 128-bit lane, the compare mask holds a nibble of each
+RASTER_TARGET("avx512f,avx512bw")
+static void shape_cells_avx512(const float* sums, size_t stride, const float* reciprocal, const float* means,
+                               unsigned short* masks, float* spreads, int count) {
+    const __m512i cell_of_lane = _mm512_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+    __m512 scale[4];
+    for(int r=0;r<4;r++) {
+        scale[r] = _mm512_broadcast_f32x4(_mm_loadu_ps(reciprocal + 4*r));
+    }
+    int i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m512 mean = _mm512_permutexvar_ps(cell_of_lane, _mm512_castps128_ps512(_mm_loadu_ps(means + i)));
+        __m512 low = _mm512_mul_ps(_mm512_loadu_ps(sums + 4*i), scale[0]), high = low;
+        unsigned int bits[4];
+        bits[0] = _mm512_cmp_ps_mask(low, mean, _CMP_GT_OQ);
+        for(int r=1;r<4;r++) {
+            __m512 average = _mm512_mul_ps(_mm512_loadu_ps(sums + r*stride + 4*i), scale[r]);
+            bits[r] = _mm512_cmp_ps_mask(average, mean, _CMP_GT_OQ);
+            low = _mm512_min_ps(low, average);
+            high = _mm512_max_ps(high, average);
+        }
+        low = _mm512_min_ps(low, _mm512_permute_ps(low, _MM_SHUFFLE(1, 0, 3, 2)));
+        low = _mm512_min_ps(low, _mm512_permute_ps(low, _MM_SHUFFLE(2, 3, 0, 1)));
+        high = _mm512_max_ps(high, _mm512_permute_ps(high, _MM_SHUFFLE(1, 0, 3, 2)));
+        high = _mm512_max_ps(high, _mm512_permute_ps(high, _MM_SHUFFLE(2, 3, 0, 1)));
+        _mm_storeu_ps(spreads + i, _mm512_castps512_ps128(_mm512_maskz_compress_ps(0x1111, _mm512_sub_ps(high, low))));
+        for(int c=0;c<4;c++) {
+            masks[i+c] = (unsigned short)(((bits[0] >> 4*c) & 15) | ((bits[1] >> 4*c) & 15) << 4 |
+                                          ((bits[2] >> 4*c) & 15) << 8 | ((bits[3] >> 4*c) & 15) << 12);
+        }
+    }
+    shape_cells_scalar(sums + 4*i, stride, reciprocal, means + i, masks + i, spreads + i, count - i);
+}
+
+RASTER_TARGET("avx512f,avx512bw")
+static inline void store_luma_avx512(unsigned char* dst, __m512i sum, __m512i alpha, __m512i full, __m512i weight) {
+    __m512i q = _mm512_sub_epi32(full, _mm512_mullo_epi32(sum, alpha));
+    __m512i luma = _mm512_srli_epi32(_mm512_add_epi32(_mm512_mullo_epi32(q, weight), _mm512_set1_epi32(1 << 23)), 24);
+    _mm_storeu_si128((__m128i*)dst, _mm512_cvtepi32_epi8(luma));
+}
+
+RASTER_TARGET("avx512f,avx512bw")
+static void luma_avx512(const unsigned char* src, unsigned char* dst, size_t count, int channels) {
+    const __m512i full = _mm512_set1_epi32(brightness_full(channels));
+    const __m512i weight = _mm512_set1_epi32(luma_weight(channels));
+    const __m512i opaque = _mm512_set1_epi32(255);
+    size_t i = 0;
+    switch(channels) {
+    case 1:
+        for(; i + 16 <= count; i += 16) {
+            __m512i px = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+            store_luma_avx512(dst + i, px, opaque, full, weight);
+        }
+        break;
+    case 2:
+        for(; i + 16 <= count; i += 16) {
+            __m512i px = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(src + 2*i)));
+            __m512i gray = _mm512_and_si512(px, _mm512_set1_epi32(0xff));
+            store_luma_avx512(dst + i, gray, _mm512_srli_epi32(px, 8), full, weight);
+        }
+        break;
+    case 3: {
+        const __m512i spread = _mm512_setr_epi32(0, 1, 2, 0, 3, 4, 5, 0, 6, 7, 8, 0, 9, 10, 11, 0);
+        const __m512i unpack = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1));
+        for(; 3*(i + 16) + 16 <= 3*count; i += 16) {
+            __m512i px = _mm512_loadu_si512((const void*)(src + 3*i));
+            px = _mm512_shuffle_epi8(_mm512_permutexvar_epi32(spread, px), unpack);
+            store_luma_avx512(dst + i, byte_sum3_avx512(px), opaque, full, weight);
+        }
+        break;
+    }
+    case 4:
+        for(; i + 16 <= count; i += 16) {
+            __m512i px = _mm512_loadu_si512((const void*)(src + 4*i));
+            store_luma_avx512(dst + i, byte_sum3_avx512(px), _mm512_srli_epi32(px, 24), full, weight);
+        }
+        break;
+    }
+    luma_scalar(src + i*channels, dst + i, count - i, channels);
+}
+
+RASTER_TARGET("avx512f,avx512bw")
+static void column_sum_u8_avx512(const unsigned char* src, unsigned short* dst, int count) {
+    int i = 0;
+    for(; i + 32 <= count; i += 32) {
+        __m512i px = _mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(src + i)));
+        _mm512_storeu_si512((void*)(dst + i), _mm512_add_epi16(_mm512_loadu_si512((const void*)(dst + i)), px));
+    }
+    column_sum_u8_scalar(src + i, dst + i, count - i);
+}
+
+RASTER_TARGET("avx512f,avx512bw")
+static void block_sum_u16_avx512(const unsigned short* cols, unsigned int* dst, int width, int sample_size, int stride) {
+    const __m512i index = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), _mm512_set1_epi32(sample_size*stride));
+    const __m512i low = _mm512_set1_epi32(0xffff);
+    int full_cells = width / sample_size;
+    size_t cell = (size_t)sample_size * stride;
+    int c = 0;
+    for(; c + 16 <= full_cells; c += 16) {
+        const unsigned short* base = cols + c*cell;
+        __m512i sum = _mm512_setzero_si512();
+        for(int k=0;k<sample_size;k++) {
+            sum = _mm512_add_epi32(sum, _mm512_and_si512(_mm512_i32gather_epi32(index, (const void*)(base + (size_t)k*stride), 2), low));
+        }
+        _mm512_storeu_si512((void*)(dst + c), sum);
+    }
+    block_sum_u16_scalar(cols + c*cell, dst + c, width - c*sample_size, sample_size, stride);
+}
+
+
+static void raster_cpuid(int leaf, int subleaf, int regs[4]) {
+#ifdef _MSC_VER
+    __cpuidex(regs, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned long long raster_xgetbv(void) {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+#endif // RASTER_SIMD_X86
+
+
+static raster_simd detect_raster_simd(void) {
+#ifdef RASTER_SIMD_X86
+    int regs[4];
+    raster_cpuid(0, 0, regs);
+    int max_leaf = regs[0];
+    raster_cpuid(1, 0, regs);
+    if(!(regs[3] & (1 << 26))) {
+        return RASTER_SIMD_SCALAR;
+    }
+    int osxsave = regs[2] & (1 << 27);
+    int avx = regs[2] & (1 << 28);
+    if(max_leaf < 7 || !osxsave || !avx) {
+        return RASTER_SIMD_SSE2;
+    }
+    unsigned long long xcr0 = raster_xgetbv();
+    raster_cpuid(7, 0, regs);
+    if((xcr0 & 0x6) != 0x6 || !(regs[1] & (1 << 5))) { // os saves ymm, avx2
+        return RASTER_SIMD_SSE2;
+    }
+    if((xcr0 & 0xe6) == 0xe6 && (regs[1] & (1 << 16)) && (regs[1] & (1 << 30))) { // os saves zmm, avx512f, avx512bw
+        return RASTER_SIMD_AVX512;
+    }
+    return RASTER_SIMD_AVX2;
+#else
+    return RASTER_SIMD_SCALAR;
+#endif
+}
+
+static const raster_kernels raster_kernel_table[] = {
+    {RASTER_SIMD_SCALAR, "scalar", brightness_scalar, column_sum_scalar, block_sum_scalar, block_sum_strided_scalar, gradient_band_scalar, shape_cells_scalar,
+     luma_scalar, column_sum_u8_scalar, block_sum_u16_scalar},
+#ifdef RASTER_SIMD_X86
+    {RASTER_SIMD_SSE2, "sse2", brightness_sse2, column_sum_sse2, block_sum_sse2, block_sum_strided_sse2, gradient_band_sse2, shape_cells_sse2,
+     luma_sse2, column_sum_u8_sse2, block_sum_u16_sse2},
+    {RASTER_SIMD_AVX2, "avx2", brightness_avx2, column_sum_avx2, block_sum_avx2, block_sum_strided_avx2, gradient_band_avx2, shape_cells_avx2,
+     luma_avx2, column_sum_u8_avx2, block_sum_u16_avx2},
+    {RASTER_SIMD_AVX512, "avx512", brightness_avx512, column_sum_avx512, block_sum_avx512, block_sum_strided_avx512, gradient_band_avx512, shape_cells_avx512,
+     luma_avx512, column_sum_u8_avx512, block_sum_u16_avx512},
+#endif
+};
+
+static once_flag detect_once = ONCE_FLAG_INIT;
+static raster_simd supported_simd;
+
+static void detect_supported_simd(void) {
+    supported_simd = detect_raster_simd();
+}
+
+const raster_kernels* get_raster_kernels(raster_simd requested) {
+    call_once(&detect_once, detect_supported_simd);
+    raster_simd level = (requested == RASTER_SIMD_AUTO || requested > supported_simd) ? supported_simd : requested;
+    for(int i = sizeof(raster_kernel_table)/sizeof(raster_kernel_table[0]) - 1; i > 0; i--) {
+        if(raster_kernel_table[i].level <= level) {
+            return &raster_kernel_table[i];
+        }
+    }
+    return &raster_kernel_table[0];
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "stddef.h"
+
+typedef enum {
+    RASTER_SIMD_AUTO,   // best level the cpu supports
+    RASTER_SIMD_SCALAR,
+    RASTER_SIMD_SSE2,
+    RASTER_SIMD_AVX2,
+    RASTER_SIMD_AVX512, // avx512f + avx512bw
+} raster_simd;
+
+// Every level produces bit-identical results: brightness is one exact integer expression and one float
+// multiply per pixel, and sums add the same values in the same order, only spread over lanes.
+typedef struct {
+    raster_simd level;
+    const char* name;
+    // dst[i] = brightness of pixel i of the interleaved src
+    void (*brightness)(const unsigned char* src, float* dst, size_t count, int channels);
+    // dst[i] += src[i], accumulates one row into per-column sums
+    void (*column_sum)(const float* src, float* dst, int count);
+    // dst[c] = cols[c*sample_size] + ... for every cell of a width-long row, last cell may be partial
+    void (*block_sum)(const float* cols, float* dst, int width, int sample_size);
+    // dst[c] = cols[c*stride] + ... + cols[c*stride + size-1] for count whole cells, block_sum with cells that
+    // only cover the first size of every stride columns
+    void (*block_sum_strided)(const float* cols, float* dst, int count, int stride, int size);
+    // Column sums of a band of count rows and of its Sobel gradients (gx, gy), in one pass down each column:
+    // rows holds count + 2 rows, the one above the band, its own and the one below (repeat the border rows at
+    // the image's top and bottom), the first and last column repeat themselves. sums gets five rows of width,
+    // stored rather than added: the rows, gx*gx, gx*gy, and gy*gy of the upper and of the lower half of the
+    // band (rows r with 2*r >= count)
+    void (*gradient_band)(const float* const* rows, int count, float* sums, int width);
+    // count cells cut into 4x4 sub-cells: sums holds 4 sub-rows stride apart, 4 sub-cell sums a cell in each.
+    // Averages are sum * reciprocal[4*sub-row + sub-cell]; masks[i] gets bit 4*sub-row + sub-cell set for every
+    // average above means[i] and spreads[i] is the largest average minus the smallest
+    void (*shape_cells)(const float* sums, size_t stride, const float* reciprocal, const float* means,
+                        unsigned short* masks, float* spreads, int count);
+
+    // fixed-point path, integer only so every level matches trivially
+    // dst[i] = brightness of pixel i scaled to 0..255 and rounded
+    void (*luma)(const unsigned char* src, unsigned char* dst, size_t count, int channels);
+    // dst[i] += src[i], 16-bit column sums hold up to 257 rows
+    void (*column_sum_u8)(const unsigned char* src, unsigned short* dst, int count);
+    // block_sum over 16-bit column sums that are stride elements apart (channels interleaved like pixels
+    // are summed one at a time), cols must have one readable element past the last column
+    void (*block_sum_u16)(const unsigned short* cols, unsigned int* dst, int width, int sample_size, int stride);
+} raster_kernels;
+
+// requested level capped to what the cpu supports, RASTER_SIMD_AUTO picks the best one
+const raster_kernels* get_raster_kernels(raster_simd requested);
@@ -0,0 +1,56 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
+#include "raster_stats.h"
+
+#ifdef _WIN32
+
+unsigned long long stats_now_ns(void) {
+    static LARGE_INTEGER frequency;
+    if(frequency.QuadPart == 0) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    unsigned long long ticks = counter.QuadPart;
+    unsigned long long per_second = frequency.QuadPart;
+    // whole seconds and the rest apart, ticks * 1e9 alone would overflow after a few hours of uptime
+    return ticks / per_second * 1000000000ull + ticks % per_second * 1000000000ull / per_second;
+}
+
+unsigned long long stats_peak_rss(void) {
+    PROCESS_MEMORY_COUNTERS counters;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+}
+
+#else
+
+unsigned long long stats_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+unsigned long long stats_peak_rss(void) {
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss; // bytes there
+#else
+    return (unsigned long long)usage.ru_maxrss * 1024; // kilobytes everywhere else
+#endif
+}
+
+#endif
@@ -0,0 +1,7 @@
+#pragma once
+
+// monotonic nanoseconds since an arbitrary point, only differences mean anything
+unsigned long long stats_now_ns(void);
+
+// largest resident set this process has had so far in bytes, 0 where the platform doesn't say
+unsigned long long stats_peak_rss(void);
@@ -0,0 +1,24 @@
+#include "raster_stb.h"
+
+// arena stb_image allocates from on this thread while a context conversion runs, NULL means the heap
+static RASTER_THREAD_LOCAL raster_arena* decode_arena;
+
+void raster_stb_use_arena(raster_arena* arena) {
+    decode_arena = arena;
+}
+
+static void* stbi_arena_malloc(size_t size) {
+    return arena_alloc(decode_arena, size);
+}
+static void* stbi_arena_realloc(void* ptr, size_t old_size, size_t size) {
+    return arena_realloc(decode_arena, ptr, old_size, size);
+}
+static void stbi_arena_free(void* ptr) {
+    arena_free(decode_arena, ptr);
+}
+
+#define STBI_MALLOC(size) stbi_arena_malloc(size)
+#define STBI_REALLOC_SIZED(ptr, old_size, size) stbi_arena_realloc(ptr, old_size, size)
+#define STBI_FREE(ptr) stbi_arena_free(ptr)
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "raster_arena.h"
+
+// stb_image's implementation lives in raster_stb.c on its own, see CMakeLists.txt; the rest of the converter
+// includes stb_image.h for the declarations only.
+// stb_image allocates from arena on this thread until this is called again, NULL means the heap
+void raster_stb_use_arena(raster_arena* arena);
@@ -437,6 +437,31 @@ STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int *
 STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
 
+////////////////////////////////////
+//
+// row-at-a-time interface
+//
+// for images too big to hold decoded: begin gets the size and the components per pixel of the rows
+// (desired_channels, or what stbi_load reports when that is 0), then row gets every row top to bottom as
+// x*comp 8-bit components that are only valid during the call; either one returns 0 to stop the decode.
+// baseline jpegs and
+// non-interlaced pngs are decoded a few rows at a time, everything else is decoded whole and then handed
+// over row by row. stbi_set_jpeg_scale_on_load applies, flip-on-load does not. returns 1 on success
+
+typedef struct
+{
+   int      (*begin) (void *user, int x, int y, int comp);
+   int      (*row)   (void *user, stbi_uc const *pixels, int y);
+} stbi_row_callbacks;
+
+STBIDEF int stbi_load_rows_from_memory   (stbi_uc           const *buffer, int len   , int desired_channels, stbi_row_callbacks const *rows, void *rows_user);
+STBIDEF int stbi_load_rows_from_callbacks(stbi_io_callbacks const *clbk  , void *user, int desired_channels, stbi_row_callbacks const *rows, void *rows_user);
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_rows               (char const *filename, int desired_channels, stbi_row_callbacks const *rows, void *rows_user);
+STBIDEF int stbi_load_rows_from_file     (FILE *f, int desired_channels, stbi_row_callbacks const *rows, void *rows_user);
+#endif
+
 ////////////////////////////////////
 //
 // 16-bits-per-channel interface
@@ -524,6 +549,15 @@ STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpre
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// decode jpegs at 1/2, 1/4 or 1/8 of their size (scale_shift 1, 2 or 3; 0 is full size) by reducing every
+// 8x8 block as it leaves the idct, each output pixel is the average of the pixels it replaces; the
+// reported width and height are the reduced ones, rounded up (stbi_info still reports the full size).
+// other formats ignore it
+STBIDEF void stbi_set_jpeg_scale_on_load(int scale_shift);
+STBIDEF void stbi_set_jpeg_scale_on_load_thread(int scale_shift);
+// the scale_shift the last load on this thread actually used, 0 unless it was a jpeg
+STBIDEF int stbi_jpeg_scale_applied(void);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -909,6 +943,7 @@ typedef struct
 static int      stbi__jpeg_test(stbi__context *s);
 static void    *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
 static int      stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp);
+static int      stbi__jpeg_load_rows(stbi__context *s, int req_comp, stbi_row_callbacks const *rows, void *user);
 #endif
 
 #ifndef STBI_NO_PNG
@@ -916,6 +951,7 @@ static int      stbi__png_test(stbi__context *s);
 static void    *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
 static int      stbi__png_info(stbi__context *s, int *x, int *y, int *comp);
 static int      stbi__png_is16(stbi__context *s);
+static int      stbi__png_load_rows(stbi__context *s, int req_comp, stbi_row_callbacks const *rows, void *user);
 #endif
 
 #ifndef STBI_NO_BMP
@@ -1134,9 +1170,45 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static int stbi__jpeg_scale_on_load_global = 0;
+
+STBIDEF void stbi_set_jpeg_scale_on_load(int scale_shift)
+{
+   stbi__jpeg_scale_on_load_global = scale_shift;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__jpeg_scale_on_load  stbi__jpeg_scale_on_load_global
+#else
+static STBI_THREAD_LOCAL int stbi__jpeg_scale_on_load_local, stbi__jpeg_scale_on_load_set;
+
+STBIDEF void stbi_set_jpeg_scale_on_load_thread(int scale_shift)
+{
+   stbi__jpeg_scale_on_load_local = scale_shift;
+   stbi__jpeg_scale_on_load_set = 1;
+}
+
+#define stbi__jpeg_scale_on_load  (stbi__jpeg_scale_on_load_set       \
+                                    ? stbi__jpeg_scale_on_load_local  \
+                                    : stbi__jpeg_scale_on_load_global)
+#endif // STBI_THREAD_LOCAL
+
+#ifdef STBI_THREAD_LOCAL
+static STBI_THREAD_LOCAL
+#else
+static
+#endif
+int stbi__jpeg_scale_applied;
+
+STBIDEF int stbi_jpeg_scale_applied(void)
+{
+   return stbi__jpeg_scale_applied;
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
+   stbi__jpeg_scale_applied = 0;
    ri->bits_per_channel = 8; // default is 8 so most paths don't have to be changed
    ri->channel_order = STBI_ORDER_RGB; // all current input & output are this, but this is here so we can add BGR order
    ri->num_channels = 0;
@@ -1440,6 +1512,83 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+// hands an already decoded image to the row callbacks
+static int stbi__emit_rows(stbi_uc const *pixels, int x, int y, int comp, stbi_row_callbacks const *rows, void *user)
+{
+   int j;
+   if (!rows->begin(user, x, y, comp)) return stbi__err("stopped", "Row callback stopped the decode");
+   for (j=0; j < y; ++j)
+      if (!rows->row(user, pixels + (size_t) j * x * comp, j)) return stbi__err("stopped", "Row callback stopped the decode");
+   return 1;
+}
+
+static int stbi__load_rows_main(stbi__context *s, int req_comp, stbi_row_callbacks const *rows, void *user)
+{
+   stbi__result_info ri;
+   void *result;
+   int x, y, comp, ok;
+
+   if (req_comp < 0 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+   stbi__jpeg_scale_applied = 0;
+   #ifndef STBI_NO_PNG
+   if (stbi__png_test(s))  return stbi__png_load_rows(s, req_comp, rows, user);
+   #endif
+   #ifndef STBI_NO_JPEG
+   if (stbi__jpeg_test(s)) return stbi__jpeg_load_rows(s, req_comp, rows, user);
+   #endif
+
+   // everything else is decoded whole
+   result = stbi__load_main(s, &x, &y, &comp, req_comp, &ri, 8);
+   if (result == NULL) return 0;
+   if (req_comp) comp = req_comp;
+   if (ri.bits_per_channel != 8) {
+      result = stbi__convert_16_to_8((stbi__uint16 *) result, x, y, comp);
+      if (result == NULL) return 0;
+   }
+   ok = stbi__emit_rows((stbi_uc *) result, x, y, comp, rows, user);
+   STBI_FREE(result);
+   return ok;
+}
+
+STBIDEF int stbi_load_rows_from_memory(stbi_uc const *buffer, int len, int desired_channels, stbi_row_callbacks const *rows, void *rows_user)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_rows_main(&s, desired_channels, rows, rows_user);
+}
+
+STBIDEF int stbi_load_rows_from_callbacks(stbi_io_callbacks const *clbk, void *user, int desired_channels, stbi_row_callbacks const *rows, void *rows_user)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_rows_main(&s, desired_channels, rows, rows_user);
+}
+
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_rows(char const *filename, int desired_channels, stbi_row_callbacks const *rows, void *rows_user)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   int result;
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   result = stbi_load_rows_from_file(f, desired_channels, rows, rows_user);
+   fclose(f);
+   return result;
+}
+
+STBIDEF int stbi_load_rows_from_file(FILE *f, int desired_channels, stbi_row_callbacks const *rows, void *rows_user)
+{
+   int result;
+   stbi__context s;
+   stbi__start_file(&s,f);
+   result = stbi__load_rows_main(&s, desired_channels, rows, rows_user);
+   if (result) {
+      // need to 'unget' all the characters in the IO buffer
+      fseek(f, - (int) (s.img_buffer_end - s.img_buffer), SEEK_CUR);
+   }
+   return result;
+}
+#endif // !STBI_NO_STDIO
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -1752,9 +1901,36 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_BMP) && defined(STBI_NO_PSD) && defined(STBI_NO_TGA) && defined(STBI_NO_GIF) && defined(STBI_NO_PIC) && defined(STBI_NO_PNM)
 // nothing
 #else
+// one row of x pixels, src and dest must not overlap; returns 0 for a conversion it doesn't know
+static int stbi__convert_format_row(unsigned char const *src, unsigned char *dest, int img_n, int req_comp, unsigned int x)
+{
+   int i;
+   #define STBI__COMBO(a,b)  ((a)*8+(b))
+   #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+   // convert source image with img_n components to one with req_comp components;
+   // avoid switch per pixel, so use switch per scanline and massive macros
+   switch (STBI__COMBO(img_n, req_comp)) {
+      STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=255;                                     } break;
+      STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
+      STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=255;                     } break;
+      STBI__CASE(2,1) { dest[0]=src[0];                                                  } break;
+      STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
+      STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                  } break;
+      STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=255;        } break;
+      STBI__CASE(3,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(3,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = 255;    } break;
+      STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
+      STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
+      default: STBI_ASSERT(0); return 0;
+   }
+   #undef STBI__CASE
+   return 1;
+}
+
 static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-   int i,j;
+   int j;
    unsigned char *good;
 
    if (req_comp == img_n) return data;
@@ -1767,29 +1943,9 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
    }
 
    for (j=0; j < (int) y; ++j) {
-      unsigned char *src  = data + j * x * img_n   ;
-      unsigned char *dest = good + j * x * req_comp;
-
-      #define STBI__COMBO(a,b)  ((a)*8+(b))
-      #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-      // convert source image with img_n components to one with req_comp components;
-      // avoid switch per pixel, so use switch per scanline and massive macros
-      switch (STBI__COMBO(img_n, req_comp)) {
-         STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=255;                                     } break;
-         STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
-         STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=255;                     } break;
-         STBI__CASE(2,1) { dest[0]=src[0];                                                  } break;
-         STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                  } break;
-         STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                  } break;
-         STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=255;        } break;
-         STBI__CASE(3,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(3,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = 255;    } break;
-         STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
-         STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+      if (!stbi__convert_format_row(data + j * x * img_n, good + j * x * req_comp, img_n, req_comp, x)) {
+         STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
       }
-      #undef STBI__CASE
    }
 
    STBI_FREE(data);
@@ -1809,9 +1965,36 @@ static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
 #if defined(STBI_NO_PNG) && defined(STBI_NO_PSD)
 // nothing
 #else
+// stbi__convert_format_row for 16-bit components
+static int stbi__convert_format16_row(stbi__uint16 const *src, stbi__uint16 *dest, int img_n, int req_comp, unsigned int x)
+{
+   int i;
+   #define STBI__COMBO(a,b)  ((a)*8+(b))
+   #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
+   // convert source image with img_n components to one with req_comp components;
+   // avoid switch per pixel, so use switch per scanline and massive macros
+   switch (STBI__COMBO(img_n, req_comp)) {
+      STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=0xffff;                                     } break;
+      STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
+      STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=0xffff;                     } break;
+      STBI__CASE(2,1) { dest[0]=src[0];                                                     } break;
+      STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
+      STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                     } break;
+      STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=0xffff;        } break;
+      STBI__CASE(3,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(3,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = 0xffff; } break;
+      STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
+      STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
+      STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
+      default: STBI_ASSERT(0); return 0;
+   }
+   #undef STBI__CASE
+   return 1;
+}
+
 static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
 {
-   int i,j;
+   int j;
    stbi__uint16 *good;
 
    if (req_comp == img_n) return data;
@@ -1824,29 +2007,9 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
    }
 
    for (j=0; j < (int) y; ++j) {
-      stbi__uint16 *src  = data + j * x * img_n   ;
-      stbi__uint16 *dest = good + j * x * req_comp;
-
-      #define STBI__COMBO(a,b)  ((a)*8+(b))
-      #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
-      // convert source image with img_n components to one with req_comp components;
-      // avoid switch per pixel, so use switch per scanline and massive macros
-      switch (STBI__COMBO(img_n, req_comp)) {
-         STBI__CASE(1,2) { dest[0]=src[0]; dest[1]=0xffff;                                     } break;
-         STBI__CASE(1,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
-         STBI__CASE(1,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=0xffff;                     } break;
-         STBI__CASE(2,1) { dest[0]=src[0];                                                     } break;
-         STBI__CASE(2,3) { dest[0]=dest[1]=dest[2]=src[0];                                     } break;
-         STBI__CASE(2,4) { dest[0]=dest[1]=dest[2]=src[0]; dest[3]=src[1];                     } break;
-         STBI__CASE(3,4) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];dest[3]=0xffff;        } break;
-         STBI__CASE(3,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(3,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = 0xffff; } break;
-         STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
-         STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
-         STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
+      if (!stbi__convert_format16_row(data + j * x * img_n, good + j * x * req_comp, img_n, req_comp, x)) {
+         STBI_FREE(data); STBI_FREE(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
       }
-      #undef STBI__CASE
    }
 
    STBI_FREE(data);
@@ -1969,6 +2132,7 @@ typedef struct
       int dc_pred;
 
       int x,y,w2,h2;
+      int plane_h; // rows of data at the decoded scale, a ring of three mcu rows when decoding a row at a time
       stbi_uc *data;
       void *raw_data, *raw_coeff;
       stbi_uc *linebuf;
@@ -1993,6 +2157,12 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+   int scale_shift; // component planes hold 8>>scale_shift pixels per block side
+   struct stbi__jpeg_rows *rows; // set by stbi__jpeg_load_rows
+   int ring;                     // the component planes only hold the mcu rows around the next output row
+   int scan_rows;                // the current scan completes output rows as it goes
+   int want_gray;                // the caller asked for 1 or 2 components
+   int luma_only;                // gray output of a YCbCr image: chroma is entropy-decoded, never transformed or kept
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
@@ -2946,6 +3116,38 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// stores one idct'd block whose top left is at full-size position x,y of component n, reduced by scale_shift
+static void stbi__jpeg_put_block(stbi__jpeg *z, int n, int x, int y, short data[64])
+{
+   int shift = z->scale_shift;
+   int stride = z->img_comp[n].w2 >> shift, row = y >> shift;
+   stbi_uc *out;
+   if (n && z->luma_only) return;
+   if (row >= z->img_comp[n].plane_h) row %= z->img_comp[n].plane_h;
+   out = z->img_comp[n].data + stride*row + (x >> shift);
+   if (shift == 0) {
+      z->idct_block_kernel(out, stride, data);
+   } else if (shift == 3) {
+      // the average of a block is its dc term over 8, no idct needed
+      out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+   } else {
+      STBI_SIMD_ALIGN(stbi_uc, block[64]);
+      int size = 8 >> shift, round = 1 << (2*shift - 1), i, j, u, v;
+      z->idct_block_kernel(block, 8, data);
+      for (j=0; j < size; ++j) {
+         for (i=0; i < size; ++i) {
+            int sum = 0;
+            for (v=0; v < (1 << shift); ++v)
+               for (u=0; u < (1 << shift); ++u)
+                  sum += block[((j << shift) + v)*8 + (i << shift) + u];
+            out[j*stride + i] = (stbi_uc) ((sum + round) >> (2*shift));
+         }
+      }
+   }
+}
+
+static int stbi__jpeg_rows_done(stbi__jpeg *z, int y);
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
@@ -2964,7 +3166,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_put_block(z, n, i*8, j*8, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2974,6 +3176,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   stbi__jpeg_reset(z);
                }
             }
+            if (z->rows && !stbi__jpeg_rows_done(z, j*8 * (z->img_v_max / z->img_comp[n].v))) return 0;
          }
          return 1;
       } else { // interleaved
@@ -2992,7 +3195,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                         int y2 = (j*z->img_comp[n].v + y)*8;
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        stbi__jpeg_put_block(z, n, x2, y2, data);
                      }
                   }
                }
@@ -3004,6 +3207,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   stbi__jpeg_reset(z);
                }
             }
+            if (z->rows && !stbi__jpeg_rows_done(z, j*z->img_mcu_h)) return 0;
          }
          return 1;
       }
@@ -3082,14 +3286,14 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
    if (z->progressive) {
       // dequantize and idct the data
       int i,j,n;
-      for (n=0; n < z->s->img_n; ++n) {
+      for (n=0; n < (z->luma_only ? 1 : z->s->img_n); ++n) {
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
          for (j=0; j < h; ++j) {
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_put_block(z, n, i*8, j*8, data);
             }
          }
       }
@@ -3261,6 +3465,57 @@ static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
    return why;
 }
 
+static int stbi__jpeg_alloc_plane(stbi__jpeg *z, int n)
+{
+   z->img_comp[n].raw_data = stbi__malloc_mad2(z->img_comp[n].w2 >> z->scale_shift, z->img_comp[n].plane_h, 15);
+   if (z->img_comp[n].raw_data == NULL) return 0;
+   // align blocks for idct using mmx/sse
+   z->img_comp[n].data = (stbi_uc*) (((size_t) z->img_comp[n].raw_data + 15) & ~15);
+   return 1;
+}
+
+static int stbi__jpeg_is_rgb(stbi__jpeg *z)
+{
+   return z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+}
+
+// decided at the first scan, once every marker that affects the color transform has been seen
+static void stbi__jpeg_check_luma_only(stbi__jpeg *z)
+{
+   int i;
+   if (!z->want_gray || z->luma_only || z->s->img_n != 3 || stbi__jpeg_is_rgb(z)) return;
+   z->luma_only = 1;
+   for (i=1; i < 3; ++i) {
+      STBI_FREE(z->img_comp[i].raw_data);
+      z->img_comp[i].raw_data = NULL;
+      z->img_comp[i].data = NULL;
+   }
+}
+
+// with ring planes a scan can only go ahead if it carries every component the output uses, so rows are
+// complete as it goes; a scan carrying none of them (chroma of a luma_only image) just doesn't emit
+static int stbi__jpeg_ring_scan(stbi__jpeg *z)
+{
+   int k, needed = z->luma_only ? 1 : z->s->img_n, has = 0;
+   for (k=0; k < z->scan_n; ++k)
+      if (z->order[k] < needed) ++has;
+   z->scan_rows = has == needed;
+   return has == needed || has == 0;
+}
+
+// components coded in separate scans need their whole planes after all; called before any block is decoded
+static int stbi__jpeg_unring(stbi__jpeg *z)
+{
+   int i;
+   for (i=0; i < (z->luma_only ? 1 : z->s->img_n); ++i) {
+      STBI_FREE(z->img_comp[i].raw_data);
+      z->img_comp[i].plane_h = z->img_comp[i].h2 >> z->scale_shift;
+      if (!stbi__jpeg_alloc_plane(z, i)) return stbi__err("outofmem", "Out of memory");
+   }
+   z->ring = 0;
+   return 1;
+}
+
 static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 {
    stbi__context *s = z->s;
@@ -3334,11 +3589,14 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
-      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
-      if (z->img_comp[i].raw_data == NULL)
+      z->img_comp[i].plane_h = z->img_comp[i].h2 >> z->scale_shift;
+      // a sequential image decoded a row at a time only needs the mcu rows that are still being upsampled
+      if (z->rows && !z->progressive && z->img_comp[i].plane_h > 3 * (z->img_comp[i].v * 8 >> z->scale_shift)) {
+         z->img_comp[i].plane_h = 3 * (z->img_comp[i].v * 8 >> z->scale_shift);
+         z->ring = 1;
+      }
+      if (!stbi__jpeg_alloc_plane(z, i))
          return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
-      // align blocks for idct using mmx/sse
-      z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
          // w2, h2 are multiples of 8 (see above)
          z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
@@ -3422,6 +3680,8 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
    while (!stbi__EOI(m)) {
       if (stbi__SOS(m)) {
          if (!stbi__process_scan_header(j)) return 0;
+         stbi__jpeg_check_luma_only(j);
+         if (j->ring && !stbi__jpeg_ring_scan(j) && !stbi__jpeg_unring(j)) return 0;
          if (!stbi__parse_entropy_coded_data(j)) return 0;
          if (j->marker == STBI__MARKER_none ) {
          j->marker = stbi__skip_jpeg_junk_at_end(j);
@@ -3853,6 +4113,9 @@ typedef struct
    int w_lores; // horizontal pixels pre-expansion
    int ystep;   // how far through vertical expansion we are
    int ypos;    // which pre-expansion row we're on
+   int h_lores; // vertical pixels pre-expansion
+   int stride;  // bytes between two pre-expansion rows
+   stbi_uc *plane_end; // line1 wraps around to the start of the plane here
 } stbi__resample;
 
 // fast 0..255 * 0..255 => 0..255 rounded multiplication
@@ -3862,167 +4125,195 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+// resamples and color-converts the component planes one output row at a time, top to bottom
+typedef struct
 {
+   stbi__resample res_comp[4];
    int n, decode_n, is_rgb;
-   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+   stbi__uint32 x, y;  // output size, the reduced one when scale_shift is set
+   stbi__uint32 next;  // next output row
+} stbi__jpeg_output;
 
-   // validate req_comp
-   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+static int stbi__jpeg_begin_output(stbi__jpeg *z, stbi__jpeg_output *o, int req_comp)
+{
+   int k, shift = z->scale_shift, round = (1 << shift) - 1;
 
-   // load a jpeg image from whichever source, but leave in YCbCr format
-   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+   o->x = (z->s->img_x + round) >> shift;
+   o->y = (z->s->img_y + round) >> shift;
+   o->next = 0;
 
    // determine actual number of components to generate
-   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
+   o->n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
-   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+   o->is_rgb = stbi__jpeg_is_rgb(z);
 
-   if (z->s->img_n == 3 && n < 3 && !is_rgb)
-      decode_n = 1;
+   if (z->s->img_n == 3 && o->n < 3 && !o->is_rgb)
+      o->decode_n = 1;
    else
-      decode_n = z->s->img_n;
+      o->decode_n = z->s->img_n;
 
    // nothing to do if no components requested; check this now to avoid
    // accessing uninitialized coutput[0] later
-   if (decode_n <= 0) { stbi__cleanup_jpeg(z); return NULL; }
+   if (o->decode_n <= 0) return 0;
+
+   for (k=0; k < o->decode_n; ++k) {
+      stbi__resample *r = &o->res_comp[k];
+
+      // allocate line buffer big enough for upsampling off the edges
+      // with upsample factor of 4
+      z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(o->x + 3);
+      if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+
+      r->hs      = z->img_h_max / z->img_comp[k].h;
+      r->vs      = z->img_v_max / z->img_comp[k].v;
+      r->ystep   = r->vs >> 1;
+      r->w_lores = (o->x + r->hs-1) / r->hs;
+      r->ypos    = 0;
+      r->line0   = r->line1 = z->img_comp[k].data;
+      r->h_lores = (z->img_comp[k].y + round) >> shift;
+      r->stride  = z->img_comp[k].w2 >> shift;
+      r->plane_end = z->img_comp[k].data + r->stride * z->img_comp[k].plane_h;
+
+      if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+      else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+      else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+      else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+      else                               r->resample = stbi__resample_row_generic;
+   }
+   return 1;
+}
 
-   // resample and color-convert
-   {
-      int k;
-      unsigned int i,j;
-      stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
-
-      stbi__resample res_comp[4];
-
-      for (k=0; k < decode_n; ++k) {
-         stbi__resample *r = &res_comp[k];
-
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
-         r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-         r->ypos    = 0;
-         r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-         else                               r->resample = stbi__resample_row_generic;
+// writes output row o->next, o->x pixels of o->n components
+static void stbi__jpeg_output_row(stbi__jpeg *z, stbi__jpeg_output *o, stbi_uc *out)
+{
+   int k;
+   unsigned int i;
+   int n = o->n;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+
+   for (k=0; k < o->decode_n; ++k) {
+      stbi__resample *r = &o->res_comp[k];
+      int y_bot = r->ystep >= (r->vs >> 1);
+      coutput[k] = r->resample(z->img_comp[k].linebuf,
+                               y_bot ? r->line1 : r->line0,
+                               y_bot ? r->line0 : r->line1,
+                               r->w_lores, r->hs);
+      if (++r->ystep >= r->vs) {
+         r->ystep = 0;
+         r->line0 = r->line1;
+         if (++r->ypos < r->h_lores) {
+            r->line1 += r->stride;
+            if (r->line1 == r->plane_end) r->line1 = z->img_comp[k].data;
+         }
       }
-
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
+   }
+   if (n >= 3) {
+      stbi_uc *y = coutput[0];
+      if (z->s->img_n == 3) {
+         if (o->is_rgb) {
+            for (i=0; i < o->x; ++i) {
+               out[0] = y[i];
+               out[1] = coutput[1][i];
+               out[2] = coutput[2][i];
+               out[3] = 255;
+               out += n;
             }
-         }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
          } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], o->x, n);
+         }
+      } else if (z->s->img_n == 4) {
+         if (z->app14_color_transform == 0) { // CMYK
+            for (i=0; i < o->x; ++i) {
+               stbi_uc m = coutput[3][i];
+               out[0] = stbi__blinn_8x8(coutput[0][i], m);
+               out[1] = stbi__blinn_8x8(coutput[1][i], m);
+               out[2] = stbi__blinn_8x8(coutput[2][i], m);
+               out[3] = 255;
+               out += n;
+            }
+         } else if (z->app14_color_transform == 2) { // YCCK
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], o->x, n);
+            for (i=0; i < o->x; ++i) {
+               stbi_uc m = coutput[3][i];
+               out[0] = stbi__blinn_8x8(255 - out[0], m);
+               out[1] = stbi__blinn_8x8(255 - out[1], m);
+               out[2] = stbi__blinn_8x8(255 - out[2], m);
+               out += n;
+            }
+         } else { // YCbCr + alpha?  Ignore the fourth channel for now
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], o->x, n);
+         }
+      } else
+         for (i=0; i < o->x; ++i) {
+            out[0] = out[1] = out[2] = y[i];
+            out[3] = 255; // not used if n==3
+            out += n;
+         }
+   } else {
+      if (o->is_rgb) {
+         if (n == 1)
+            for (i=0; i < o->x; ++i)
+               *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+         else {
+            for (i=0; i < o->x; ++i, out += 2) {
+               out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+               out[1] = 255;
             }
          }
+      } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+         for (i=0; i < o->x; ++i) {
+            stbi_uc m = coutput[3][i];
+            stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+            stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+            stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+            out[0] = stbi__compute_y(r, g, b);
+            out[1] = 255;
+            out += n;
+         }
+      } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+         for (i=0; i < o->x; ++i) {
+            out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+            out[1] = 255;
+            out += n;
+         }
+      } else {
+         stbi_uc *y = coutput[0];
+         if (n == 1)
+            for (i=0; i < o->x; ++i) out[i] = y[i];
+         else
+            for (i=0; i < o->x; ++i) { *out++ = y[i]; *out++ = 255; }
       }
-      stbi__cleanup_jpeg(z);
-      *out_x = z->s->img_x;
-      *out_y = z->s->img_y;
-      if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-      return output;
    }
+   ++o->next;
+}
+
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+   stbi__jpeg_output o;
+   stbi_uc *output;
+   unsigned int j;
+   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+   // validate req_comp
+   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+
+   // load a jpeg image from whichever source, but leave in YCbCr format
+   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+
+   if (!stbi__jpeg_begin_output(z, &o, req_comp)) { stbi__cleanup_jpeg(z); return NULL; }
+
+   // can't error after this so, this is safe
+   output = (stbi_uc *) stbi__malloc_mad3(o.n, o.x, o.y, 1);
+   if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+
+   // now go ahead and resample
+   for (j=0; j < o.y; ++j)
+      stbi__jpeg_output_row(z, &o, output + o.n * o.x * j);
+   stbi__cleanup_jpeg(z);
+   *out_x = o.x;
+   *out_y = o.y;
+   if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+   return output;
 }
 
 static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
@@ -4034,7 +4325,71 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    STBI_NOTUSED(ri);
    j->s = s;
    stbi__setup_jpeg(j);
+   j->scale_shift = stbi__jpeg_scale_on_load < 0 ? 0 : stbi__jpeg_scale_on_load > 3 ? 3 : stbi__jpeg_scale_on_load;
+   j->want_gray = req_comp == 1 || req_comp == 2;
    result = load_jpeg_image(j, x,y,comp,req_comp);
+   if (result) stbi__jpeg_scale_applied = j->scale_shift;
+   STBI_FREE(j);
+   return result;
+}
+
+struct stbi__jpeg_rows
+{
+   stbi_row_callbacks const *cb;
+   void *user;
+   int req_comp;
+   stbi__jpeg_output out;
+   stbi_uc *row; // one output row, NULL until the output has begun
+};
+
+// hands output rows up to (not including) row y to the callbacks, beginning the output on first use
+static int stbi__jpeg_emit_rows(stbi__jpeg *z, stbi__uint32 y)
+{
+   struct stbi__jpeg_rows *r = z->rows;
+   if (r->row == NULL) {
+      if (!stbi__jpeg_begin_output(z, &r->out, r->req_comp)) return 0;
+      r->row = (stbi_uc *) stbi__malloc_mad2(r->out.n, r->out.x, 1); // color conversion stores one byte past a 3-component row
+      if (!r->row) return stbi__err("outofmem", "Out of memory");
+      stbi__jpeg_scale_applied = z->scale_shift;
+      if (!r->cb->begin(r->user, r->out.x, r->out.y, r->out.n)) return stbi__err("stopped", "Row callback stopped the decode");
+   }
+   if (y > r->out.y) y = r->out.y;
+   while (r->out.next < y) {
+      stbi__jpeg_output_row(z, &r->out, r->row);
+      if (!r->cb->row(r->user, r->row, r->out.next - 1)) return stbi__err("stopped", "Row callback stopped the decode");
+   }
+   return 1;
+}
+
+// the mcu row (block row for a single-component scan) starting at full-size row y is decoded; with ring
+// planes every row above it is final now, upsampling never looks further down than one row
+static int stbi__jpeg_rows_done(stbi__jpeg *z, int y)
+{
+   if (!z->ring || !z->scan_rows) return 1;
+   return stbi__jpeg_emit_rows(z, y >> z->scale_shift);
+}
+
+static int stbi__jpeg_load_rows(stbi__context *s, int req_comp, stbi_row_callbacks const *rows, void *user)
+{
+   struct stbi__jpeg_rows r;
+   int result;
+   stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
+   if (!j) return stbi__err("outofmem", "Out of memory");
+   memset(j, 0, sizeof(stbi__jpeg));
+   memset(&r, 0, sizeof(r));
+   r.cb = rows;
+   r.user = user;
+   r.req_comp = req_comp;
+   j->s = s;
+   j->rows = &r;
+   stbi__setup_jpeg(j);
+   j->scale_shift = stbi__jpeg_scale_on_load < 0 ? 0 : stbi__jpeg_scale_on_load > 3 ? 3 : stbi__jpeg_scale_on_load;
+   j->want_gray = req_comp == 1 || req_comp == 2;
+   s->img_n = 0; // make stbi__cleanup_jpeg safe
+   // the rows still missing, all of them if the planes were not rings
+   result = stbi__decode_jpeg_image(j) && stbi__jpeg_emit_rows(j, s->img_y);
+   STBI_FREE(r.row);
+   stbi__cleanup_jpeg(j);
    STBI_FREE(j);
    return result;
 }
@@ -4186,12 +4541,33 @@ typedef struct
    char *zout_end;
    int   z_expandable;
 
+   // streaming: input arrives in pieces through refill (returns the byte count, 0 at the end), and
+   // instead of growing, the output window hands its bytes to flush (returns how many it consumed)
+   // and slides down, keeping the 32k of history back-references can reach
+   int (*refill)(void *user, stbi_uc **data);
+   int (*flush)(void *user, stbi_uc *data, int len);
+   void *stream_user;
+   char *zflushed; // start of the output flush has not consumed yet
+
    stbi__zhuffman z_length, z_distance;
 } stbi__zbuf;
 
+static int stbi__zrefill(stbi__zbuf *z)
+{
+   int n;
+   if (z->refill == NULL) return 0;
+   n = z->refill(z->stream_user, &z->zbuffer);
+   if (n <= 0) {
+      z->refill = NULL;
+      return 0;
+   }
+   z->zbuffer_end = z->zbuffer + n;
+   return 1;
+}
+
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
 {
-   return (z->zbuffer >= z->zbuffer_end);
+   return (z->zbuffer >= z->zbuffer_end) && !stbi__zrefill(z);
 }
 
 stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
@@ -4204,6 +4580,7 @@ static void stbi__fill_bits(stbi__zbuf *z)
    do {
       if (z->code_buffer >= (1U << z->num_bits)) {
         z->zbuffer = z->zbuffer_end;  /* treat this as EOF so we fail. */
+        z->refill = NULL;
         return;
       }
       z->code_buffer |= (unsigned int) stbi__zget8(z) << z->num_bits;
@@ -4270,11 +4647,31 @@ stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
    return stbi__zhuffman_decode_slowpath(a, z);
 }
 
+static int stbi__zflush(stbi__zbuf *z, int n)  // streaming counterpart of stbi__zexpand
+{
+   char *keep;
+   int used = z->flush(z->stream_user, (stbi_uc *) z->zflushed, (int) (z->zout - z->zflushed));
+   if (used < 0) return 0; // flush set the error
+   z->zflushed += used;
+   // slide the window down to the unconsumed bytes or the last 32k, whichever starts earlier
+   keep = z->zout - z->zout_start > 32768 ? z->zout - 32768 : z->zout_start;
+   if (z->zflushed < keep) keep = z->zflushed;
+   if (keep > z->zout_start) {
+      ptrdiff_t shift = keep - z->zout_start;
+      memmove(z->zout_start, keep, z->zout - keep);
+      z->zout -= shift;
+      z->zflushed -= shift;
+   }
+   if (z->zout_end - z->zout < n) return stbi__err("output buffer limit","Corrupt PNG");
+   return 1;
+}
+
 static int stbi__zexpand(stbi__zbuf *z, char *zout, int n)  // need to make room for n bytes
 {
    char *q;
    unsigned int cur, limit, old_limit;
    z->zout = zout;
+   if (z->flush) return stbi__zflush(z, n);
    if (!z->z_expandable) return stbi__err("output buffer limit","Corrupt PNG");
    cur   = (unsigned int) (z->zout - z->zout_start);
    limit = old_limit = (unsigned) (z->zout_end - z->zout_start);
@@ -4426,12 +4823,20 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
    if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt","Corrupt PNG");
-   if (a->zbuffer + len > a->zbuffer_end) return stbi__err("read past buffer","Corrupt PNG");
-   if (a->zout + len > a->zout_end)
-      if (!stbi__zexpand(a, a->zout, len)) return 0;
-   memcpy(a->zout, a->zbuffer, len);
-   a->zbuffer += len;
-   a->zout += len;
+   if (a->refill == NULL && a->zbuffer + len > a->zbuffer_end) return stbi__err("read past buffer","Corrupt PNG");
+   // streamed input comes in pieces and a flushed window only promises 32k of room
+   while (len > 0) {
+      int n = len;
+      if (stbi__zeof(a)) return stbi__err("read past buffer","Corrupt PNG");
+      if (n > a->zbuffer_end - a->zbuffer) n = (int) (a->zbuffer_end - a->zbuffer);
+      if (a->flush && n > 32768) n = 32768;
+      if (a->zout + n > a->zout_end)
+         if (!stbi__zexpand(a, a->zout, n)) return 0;
+      memcpy(a->zout, a->zbuffer, n);
+      a->zbuffer += n;
+      a->zout += n;
+      len -= n;
+   }
    return 1;
 }
 
@@ -4513,6 +4918,8 @@ static int stbi__do_zlib(stbi__zbuf *a, char *obuf, int olen, int exp, int parse
    a->zout       = obuf;
    a->zout_end   = obuf + olen;
    a->z_expandable = exp;
+   a->refill = NULL;
+   a->flush = NULL;
 
    return stbi__parse_zlib(a, parse_header);
 }
@@ -4632,6 +5039,8 @@ typedef struct
    stbi__context *s;
    stbi_uc *idata, *expanded, *out;
    int depth;
+   stbi_row_callbacks const *rows; // set to stream a non-interlaced image a row at a time
+   void *rows_user;
 } stbi__png;
 
 
@@ -4692,16 +5101,123 @@ static void stbi__create_png_alpha_expand8(stbi_uc *dest, stbi_uc *src, stbi__ui
    }
 }
 
+// undoes the filter of one scanline, prior is the previous scanline after its own defiltering
+static void stbi__png_defilter_row(stbi_uc *cur, stbi_uc *prior, stbi_uc const *raw, int filter, int filter_bytes, int nk)
+{
+   int k;
+   // perform actual filtering
+   switch (filter) {
+   case STBI__F_none:
+      memcpy(cur, raw, nk);
+      break;
+   case STBI__F_sub:
+      memcpy(cur, raw, filter_bytes);
+      for (k = filter_bytes; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + cur[k-filter_bytes]);
+      break;
+   case STBI__F_up:
+      for (k = 0; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+      break;
+   case STBI__F_avg:
+      for (k = 0; k < filter_bytes; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + (prior[k]>>1));
+      for (k = filter_bytes; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k-filter_bytes])>>1));
+      break;
+   case STBI__F_paeth:
+      for (k = 0; k < filter_bytes; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + prior[k]); // prior[k] == stbi__paeth(0,prior[k],0)
+      for (k = filter_bytes; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes], prior[k], prior[k-filter_bytes]));
+      break;
+   case STBI__F_avg_first:
+      memcpy(cur, raw, filter_bytes);
+      for (k = filter_bytes; k < nk; ++k)
+         cur[k] = STBI__BYTECAST(raw[k] + (cur[k-filter_bytes] >> 1));
+      break;
+   }
+}
+
+// one defiltered scanline to out_n components per pixel, 8 bits (scaled up) or 16 bits native-endian
+static void stbi__png_expand_row(stbi_uc *dest, stbi_uc *cur, stbi__uint32 x, int img_n, int out_n, int depth, int color)
+{
+   stbi__uint32 i;
+   // expand decoded bits in cur to dest, also adding an extra alpha channel if desired
+   if (depth < 8) {
+      stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
+      stbi_uc *in = cur;
+      stbi_uc *out = dest;
+      stbi_uc inb = 0;
+      stbi__uint32 nsmp = x*img_n;
+
+      // expand bits to bytes first
+      if (depth == 4) {
+         for (i=0; i < nsmp; ++i) {
+            if ((i & 1) == 0) inb = *in++;
+            *out++ = scale * (inb >> 4);
+            inb <<= 4;
+         }
+      } else if (depth == 2) {
+         for (i=0; i < nsmp; ++i) {
+            if ((i & 3) == 0) inb = *in++;
+            *out++ = scale * (inb >> 6);
+            inb <<= 2;
+         }
+      } else {
+         STBI_ASSERT(depth == 1);
+         for (i=0; i < nsmp; ++i) {
+            if ((i & 7) == 0) inb = *in++;
+            *out++ = scale * (inb >> 7);
+            inb <<= 1;
+         }
+      }
+
+      // insert alpha=255 values if desired
+      if (img_n != out_n)
+         stbi__create_png_alpha_expand8(dest, dest, x, img_n);
+   } else if (depth == 8) {
+      if (img_n == out_n)
+         memcpy(dest, cur, x*img_n);
+      else
+         stbi__create_png_alpha_expand8(dest, cur, x, img_n);
+   } else if (depth == 16) {
+      // convert the image data from big-endian to platform-native
+      stbi__uint16 *dest16 = (stbi__uint16*)dest;
+      stbi__uint32 nsmp = x*img_n;
+
+      if (img_n == out_n) {
+         for (i = 0; i < nsmp; ++i, ++dest16, cur += 2)
+            *dest16 = (cur[0] << 8) | cur[1];
+      } else {
+         STBI_ASSERT(img_n+1 == out_n);
+         if (img_n == 1) {
+            for (i = 0; i < x; ++i, dest16 += 2, cur += 2) {
+               dest16[0] = (cur[0] << 8) | cur[1];
+               dest16[1] = 0xffff;
+            }
+         } else {
+            STBI_ASSERT(img_n == 3);
+            for (i = 0; i < x; ++i, dest16 += 4, cur += 6) {
+               dest16[0] = (cur[0] << 8) | cur[1];
+               dest16[1] = (cur[2] << 8) | cur[3];
+               dest16[2] = (cur[4] << 8) | cur[5];
+               dest16[3] = 0xffff;
+            }
+         }
+      }
+   }
+}
+
 // create the png data from post-deflated data
 static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
 {
    int bytes = (depth == 16 ? 2 : 1);
    stbi__context *s = a->s;
-   stbi__uint32 i,j,stride = x*out_n*bytes;
+   stbi__uint32 j,stride = x*out_n*bytes;
    stbi__uint32 img_len, img_width_bytes;
    stbi_uc *filter_buf;
    int all_ok = 1;
-   int k;
    int img_n = s->img_n; // copy it into a local for later
 
    int output_bytes = out_n*bytes;
@@ -4751,105 +5267,9 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
 
-      // perform actual filtering
-      switch (filter) {
-      case STBI__F_none:
-         memcpy(cur, raw, nk);
-         break;
-      case STBI__F_sub:
-         memcpy(cur, raw, filter_bytes);
-         for (k = filter_bytes; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + cur[k-filter_bytes]);
-         break;
-      case STBI__F_up:
-         for (k = 0; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
-         break;
-      case STBI__F_avg:
-         for (k = 0; k < filter_bytes; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + (prior[k]>>1));
-         for (k = filter_bytes; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + cur[k-filter_bytes])>>1));
-         break;
-      case STBI__F_paeth:
-         for (k = 0; k < filter_bytes; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + prior[k]); // prior[k] == stbi__paeth(0,prior[k],0)
-         for (k = filter_bytes; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(cur[k-filter_bytes], prior[k], prior[k-filter_bytes]));
-         break;
-      case STBI__F_avg_first:
-         memcpy(cur, raw, filter_bytes);
-         for (k = filter_bytes; k < nk; ++k)
-            cur[k] = STBI__BYTECAST(raw[k] + (cur[k-filter_bytes] >> 1));
-         break;
-      }
-
+      stbi__png_defilter_row(cur, prior, raw, filter, filter_bytes, nk);
       raw += nk;
-
-      // expand decoded bits in cur to dest, also adding an extra alpha channel if desired
-      if (depth < 8) {
-         stbi_uc scale = (color == 0) ? stbi__depth_scale_table[depth] : 1; // scale grayscale values to 0..255 range
-         stbi_uc *in = cur;
-         stbi_uc *out = dest;
-         stbi_uc inb = 0;
-         stbi__uint32 nsmp = x*img_n;
-
-         // expand bits to bytes first
-         if (depth == 4) {
-            for (i=0; i < nsmp; ++i) {
-               if ((i & 1) == 0) inb = *in++;
-               *out++ = scale * (inb >> 4);
-               inb <<= 4;
-            }
-         } else if (depth == 2) {
-            for (i=0; i < nsmp; ++i) {
-               if ((i & 3) == 0) inb = *in++;
-               *out++ = scale * (inb >> 6);
-               inb <<= 2;
-            }
-         } else {
-            STBI_ASSERT(depth == 1);
-            for (i=0; i < nsmp; ++i) {
-               if ((i & 7) == 0) inb = *in++;
-               *out++ = scale * (inb >> 7);
-               inb <<= 1;
-            }
-         }
-
-         // insert alpha=255 values if desired
-         if (img_n != out_n)
-            stbi__create_png_alpha_expand8(dest, dest, x, img_n);
-      } else if (depth == 8) {
-         if (img_n == out_n)
-            memcpy(dest, cur, x*img_n);
-         else
-            stbi__create_png_alpha_expand8(dest, cur, x, img_n);
-      } else if (depth == 16) {
-         // convert the image data from big-endian to platform-native
-         stbi__uint16 *dest16 = (stbi__uint16*)dest;
-         stbi__uint32 nsmp = x*img_n;
-
-         if (img_n == out_n) {
-            for (i = 0; i < nsmp; ++i, ++dest16, cur += 2)
-               *dest16 = (cur[0] << 8) | cur[1];
-         } else {
-            STBI_ASSERT(img_n+1 == out_n);
-            if (img_n == 1) {
-               for (i = 0; i < x; ++i, dest16 += 2, cur += 2) {
-                  dest16[0] = (cur[0] << 8) | cur[1];
-                  dest16[1] = 0xffff;
-               }
-            } else {
-               STBI_ASSERT(img_n == 3);
-               for (i = 0; i < x; ++i, dest16 += 4, cur += 6) {
-                  dest16[0] = (cur[0] << 8) | cur[1];
-                  dest16[1] = (cur[2] << 8) | cur[3];
-                  dest16[2] = (cur[4] << 8) | cur[5];
-                  dest16[3] = 0xffff;
-               }
-            }
-         }
-      }
+      stbi__png_expand_row(dest, cur, x, img_n, out_n, depth, color);
    }
 
    STBI_FREE(filter_buf);
@@ -4903,11 +5323,9 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    return 1;
 }
 
-static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
+static int stbi__compute_transparency(stbi_uc *p, stbi__uint32 pixel_count, stbi_uc tc[3], int out_n)
 {
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi_uc *p = z->out;
+   stbi__uint32 i;
 
    // compute color-based transparency, assuming we've
    // already got 255 as the alpha value in the output
@@ -4928,11 +5346,9 @@ static int stbi__compute_transparency(stbi__png *z, stbi_uc tc[3], int out_n)
    return 1;
 }
 
-static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int out_n)
+static int stbi__compute_transparency16(stbi__uint16 *p, stbi__uint32 pixel_count, stbi__uint16 tc[3], int out_n)
 {
-   stbi__context *s = z->s;
-   stbi__uint32 i, pixel_count = s->img_x * s->img_y;
-   stbi__uint16 *p = (stbi__uint16*) z->out;
+   stbi__uint32 i;
 
    // compute color-based transparency, assuming we've
    // already got 65535 as the alpha value in the output
@@ -4953,17 +5369,9 @@ static int stbi__compute_transparency16(stbi__png *z, stbi__uint16 tc[3], int ou
    return 1;
 }
 
-static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+static void stbi__png_palette_row(stbi_uc *p, stbi_uc const *orig, stbi__uint32 pixel_count, stbi_uc *palette, int pal_img_n)
 {
-   stbi__uint32 i, pixel_count = a->s->img_x * a->s->img_y;
-   stbi_uc *p, *temp_out, *orig = a->out;
-
-   p = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
-   if (p == NULL) return stbi__err("outofmem", "Out of memory");
-
-   // between here and free(out) below, exitting would leak
-   temp_out = p;
-
+   stbi__uint32 i;
    if (pal_img_n == 3) {
       for (i=0; i < pixel_count; ++i) {
          int n = orig[i]*4;
@@ -4982,6 +5390,20 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
          p += 4;
       }
    }
+}
+
+static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int pal_img_n)
+{
+   stbi__uint32 pixel_count = a->s->img_x * a->s->img_y;
+   stbi_uc *p, *temp_out;
+
+   p = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
+   if (p == NULL) return stbi__err("outofmem", "Out of memory");
+
+   // between here and free(out) below, exitting would leak
+   temp_out = p;
+
+   stbi__png_palette_row(p, a->out, pixel_count, palette, pal_img_n);
    STBI_FREE(a->out);
    a->out = temp_out;
 
@@ -5075,6 +5497,182 @@ static void stbi__de_iphone(stbi__png *z)
 
 #define STBI__PNG_TYPE(a,b,c,d)  (((unsigned) (a) << 24) + ((unsigned) (b) << 16) + ((unsigned) (c) << 8) + (unsigned) (d))
 
+#define STBI__PNG_STREAM_IN 16384
+
+typedef struct
+{
+   stbi__png *z;
+   stbi__uint32 chunk_left; // bytes of the current IDAT chunk not read yet
+   int more;                // 0 once a chunk other than IDAT has been reached
+   stbi__uint32 next;       // next output row
+   int color, img_n, out_n, pal_img_n, has_trans, req_comp;
+   int filter_bytes, nk;
+   stbi__uint32 line_bytes; // one filtered scanline, without its filter byte
+   stbi_uc *filter_buf, *line;
+   stbi_uc *pixels;         // the row handed over when it isn't line itself, up to 4 components
+   stbi_uc *convert;        // req_comp components, 16-bit ones for 16-bit images
+   stbi_uc *palette, *tc;
+   stbi__uint16 *tc16;
+} stbi__png_stream;
+
+static int stbi__png_stream_refill(void *user, stbi_uc **data)
+{
+   stbi__png_stream *r = (stbi__png_stream *) user;
+   stbi__context *s = r->z->s;
+   int n;
+   while (r->chunk_left == 0) {
+      stbi__pngchunk c;
+      if (!r->more) return 0;
+      stbi__get32be(s); // CRC of the chunk just finished
+      c = stbi__get_chunk_header(s);
+      if (c.type != STBI__PNG_TYPE('I','D','A','T') || c.length > (1u << 30)) {
+         r->more = 0;
+         return 0;
+      }
+      r->chunk_left = c.length;
+   }
+   n = r->chunk_left < STBI__PNG_STREAM_IN ? (int) r->chunk_left : STBI__PNG_STREAM_IN;
+   if (!stbi__getn(s, r->z->idata, n)) {
+      r->more = 0;
+      r->chunk_left = 0;
+      return 0;
+   }
+   r->chunk_left -= n;
+   *data = r->z->idata;
+   return n;
+}
+
+// defilters, expands and hands over every complete scanline in data
+static int stbi__png_stream_flush(void *user, stbi_uc *data, int len)
+{
+   stbi__png_stream *r = (stbi__png_stream *) user;
+   stbi__png *z = r->z;
+   stbi__uint32 x = z->s->img_x, i;
+   int used = 0;
+   while (r->next < z->s->img_y && (stbi__uint32) (len - used) > r->line_bytes) {
+      stbi_uc *cur = r->filter_buf + (r->next & 1)*r->line_bytes;
+      stbi_uc *prior = r->filter_buf + (~r->next & 1)*r->line_bytes;
+      stbi_uc *row = r->line;
+      int comp = r->out_n;
+      int filter = data[used];
+      if (filter > 4) {
+         stbi__err("invalid filter","Corrupt PNG");
+         return -1;
+      }
+      if (r->next == 0) filter = first_row_filter[filter];
+      stbi__png_defilter_row(cur, prior, data + used + 1, filter, r->filter_bytes, r->nk);
+      used += r->line_bytes + 1;
+
+      // the same steps in the same order as the whole-image path
+      stbi__png_expand_row(r->line, cur, x, r->img_n, r->out_n, z->depth, r->color);
+      if (z->depth == 16) {
+         stbi__uint16 *line16 = (stbi__uint16 *) r->line;
+         if (r->has_trans) stbi__compute_transparency16(line16, x, r->tc16, r->out_n);
+         if (r->req_comp && r->req_comp != comp) {
+            stbi__convert_format16_row(line16, (stbi__uint16 *) r->convert, comp, r->req_comp, x);
+            line16 = (stbi__uint16 *) r->convert;
+            comp = r->req_comp;
+         }
+         for (i=0; i < x * comp; ++i)
+            r->pixels[i] = (stbi_uc) (line16[i] >> 8);
+         row = r->pixels;
+      } else {
+         if (r->has_trans) stbi__compute_transparency(r->line, x, r->tc, r->out_n);
+         if (r->pal_img_n) {
+            stbi__png_palette_row(r->pixels, r->line, x, r->palette, r->pal_img_n);
+            row = r->pixels;
+            comp = r->pal_img_n;
+         }
+         if (r->req_comp && r->req_comp != comp) {
+            stbi__convert_format_row(row, r->convert, comp, r->req_comp, x);
+            row = r->convert;
+         }
+      }
+      if (!z->rows->row(z->rows_user, row, r->next++)) {
+         stbi__err("stopped", "Row callback stopped the decode");
+         return -1;
+      }
+   }
+   // trailing bytes past the last row are ignored, like the whole-image path does
+   return r->next == z->s->img_y ? len : used;
+}
+
+// inflates through a window of wlen bytes, which must exceed 32k by enough to hold what flush may leave behind
+static int stbi__do_zlib_stream(stbi__zbuf *a, char *window, int wlen, int parse_header)
+{
+   a->zbuffer = a->zbuffer_end = NULL;
+   a->zout_start = a->zout = a->zflushed = window;
+   a->zout_end   = window + wlen;
+   a->z_expandable = 0;
+
+   if (!stbi__parse_zlib(a, parse_header)) return 0;
+   return stbi__zflush(a, 0);
+}
+
+// inflates the IDAT chunks starting with one of length first_len a window at a time, so memory stays
+// a few scanlines no matter how tall the image is
+static int stbi__png_stream_rows(stbi__png *z, stbi__uint32 first_len, int req_comp, int color, stbi_uc *palette, int pal_img_n,
+                                 int has_trans, stbi_uc *tc, stbi__uint16 *tc16)
+{
+   stbi__png_stream r;
+   stbi__zbuf a;
+   stbi__context *s = z->s;
+   stbi__uint32 x = s->img_x;
+   int bytes = (z->depth == 16 ? 2 : 1);
+   int window_len, ok;
+
+   memset(&r, 0, sizeof(r));
+   r.z = z;
+   r.chunk_left = first_len;
+   r.more = 1;
+   r.color = color;
+   r.img_n = s->img_n;
+   r.out_n = s->img_n + (has_trans ? 1 : 0);
+   r.pal_img_n = pal_img_n;
+   r.has_trans = has_trans;
+   r.req_comp = req_comp;
+   r.palette = palette;
+   r.tc = tc;
+   r.tc16 = tc16;
+
+   if (!stbi__mad3sizes_valid(r.img_n, x, z->depth, 7)) return stbi__err("too large", "Corrupt PNG");
+   r.line_bytes = ((r.img_n * x * z->depth) + 7) >> 3;
+   if (r.line_bytes > (1u << 29)) return stbi__err("too large", "Corrupt PNG");
+   if (z->depth < 8) {
+      r.filter_bytes = 1;
+      r.nk = r.line_bytes;
+   } else {
+      r.filter_bytes = r.img_n * bytes;
+      r.nk = x * r.filter_bytes;
+   }
+   window_len = 32768 + (int) r.line_bytes + 1 + 32768;
+
+   // the scratch buffers go where stbi__png_load_rows frees them
+   z->idata = (stbi_uc *) stbi__malloc(STBI__PNG_STREAM_IN);
+   z->expanded = (stbi_uc *) stbi__malloc(window_len);
+   r.filter_buf = (stbi_uc *) stbi__malloc_mad2(r.line_bytes, 2, 0);
+   r.line = (stbi_uc *) stbi__malloc_mad3(x, r.out_n, bytes, 0);
+   r.pixels = (stbi_uc *) stbi__malloc_mad2(x, 4, 0);
+   r.convert = req_comp ? (stbi_uc *) stbi__malloc_mad3(x, req_comp, bytes, 0) : NULL;
+   ok = z->idata && z->expanded && r.filter_buf && r.line && r.pixels && (r.convert || !req_comp);
+   if (!ok) {
+      ok = stbi__err("outofmem", "Out of memory");
+   } else if (!z->rows->begin(z->rows_user, x, s->img_y, req_comp ? req_comp : pal_img_n ? pal_img_n : r.out_n)) {
+      ok = stbi__err("stopped", "Row callback stopped the decode");
+   } else {
+      a.refill = stbi__png_stream_refill;
+      a.flush = stbi__png_stream_flush;
+      a.stream_user = &r;
+      ok = stbi__do_zlib_stream(&a, (char *) z->expanded, window_len, 1);
+      if (ok && r.next != s->img_y) ok = stbi__err("not enough pixels","Corrupt PNG");
+   }
+   STBI_FREE(r.filter_buf);
+   STBI_FREE(r.line);
+   STBI_FREE(r.pixels);
+   STBI_FREE(r.convert);
+   return ok;
+}
+
 static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
 {
    stbi_uc palette[1024], pal_img_n=0;
@@ -5180,6 +5778,9 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                return 1;
             }
             if (c.length > (1u << 30)) return stbi__err("IDAT size limit", "IDAT section larger than 2^30 bytes");
+            // interlaced passes and iphone pngs still need the whole image
+            if (scan == STBI__SCAN_load && z->rows && !interlace && !is_iphone)
+               return stbi__png_stream_rows(z, c.length, req_comp, color, palette, pal_img_n, has_trans, tc, tc16);
             if ((int)(ioff + c.length) < (int)ioff) return 0;
             if (ioff + c.length > idata_limit) {
                stbi__uint32 idata_limit_old = idata_limit;
@@ -5214,9 +5815,9 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             if (!stbi__create_png_image(z, z->expanded, raw_len, s->img_out_n, z->depth, color, interlace)) return 0;
             if (has_trans) {
                if (z->depth == 16) {
-                  if (!stbi__compute_transparency16(z, tc16, s->img_out_n)) return 0;
+                  if (!stbi__compute_transparency16((stbi__uint16 *) z->out, s->img_x * s->img_y, tc16, s->img_out_n)) return 0;
                } else {
-                  if (!stbi__compute_transparency(z, tc, s->img_out_n)) return 0;
+                  if (!stbi__compute_transparency(z->out, s->img_x * s->img_y, tc, s->img_out_n)) return 0;
                }
             }
             if (is_iphone && stbi__de_iphone_flag && s->img_out_n > 2)
@@ -5296,9 +5897,40 @@ static void *stbi__png_load(stbi__context *s, int *x, int *y, int *comp, int req
 {
    stbi__png p;
    p.s = s;
+   p.rows = NULL;
    return stbi__do_png(&p, x,y,comp,req_comp, ri);
 }
 
+static int stbi__png_load_rows(stbi__context *s, int req_comp, stbi_row_callbacks const *rows, void *user)
+{
+   stbi__png p;
+   int result;
+   p.s = s;
+   p.rows = rows;
+   p.rows_user = user;
+   result = stbi__parse_png_file(&p, STBI__SCAN_load, req_comp);
+   if (result && p.out) {
+      // came back decoded whole (interlaced or iphone)
+      if (req_comp && req_comp != s->img_out_n) {
+         if (p.depth == 16)
+            p.out = (stbi_uc *) stbi__convert_format16((stbi__uint16 *) p.out, s->img_out_n, req_comp, s->img_x, s->img_y);
+         else
+            p.out = stbi__convert_format(p.out, s->img_out_n, req_comp, s->img_x, s->img_y);
+         s->img_out_n = req_comp;
+         result = p.out != NULL;
+      }
+      if (result && p.depth == 16) {
+         p.out = stbi__convert_16_to_8((stbi__uint16 *) p.out, s->img_x, s->img_y, s->img_out_n);
+         result = p.out != NULL;
+      }
+      if (result) result = stbi__emit_rows(p.out, s->img_x, s->img_y, s->img_out_n, rows, user);
+   }
+   STBI_FREE(p.out);
+   STBI_FREE(p.expanded);
+   STBI_FREE(p.idata);
+   return result;
+}
+
 static int stbi__png_test(stbi__context *s)
 {
    int r;
@@ -0,0 +1,11 @@
+# cmake -DCOMMAND=<converter;arguments> -DOUTPUT=<file> -DEXPECTED=<file> -P compare_output.cmake
+# Runs the converter with -o OUTPUT and fails unless OUTPUT matches EXPECTED byte for byte.
+file(REMOVE "${OUTPUT}")
+execute_process(COMMAND ${COMMAND} -o "${OUTPUT}" RESULT_VARIABLE status OUTPUT_QUIET)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "${COMMAND} exited with ${status}")
+endif()
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files "${OUTPUT}" "${EXPECTED}" RESULT_VARIABLE status)
+if(NOT status EQUAL 0)
+    message(FATAL_ERROR "${OUTPUT} differs from ${EXPECTED}")
+endif()